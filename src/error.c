@@ -1,38 +1,97 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "error.h"
 
-static void prettyprint(const char* str_msg, const char* str_expr, int from, int len) {
-    printf("\033[0;31;1merror:\033[0m %s\n", str_msg);
-    printf("\033[0;32;1mhere:\033[0m  ");
+// messages for each error code
+static const char* error_msgs[] = {
+    [LG_ERR_UNEXPECTED_CHAR] = "unexpected character",
+    [LG_ERR_EXPECTED_OPERABLE] = "expected operable value",
+    [LG_ERR_EXPECTED_OPERATOR] = "expected operator, ')', or ','",
+    [LG_ERR_EXPECTED_CLOSING_PAREN] = "expected closing bracket",
+    [LG_ERR_BAD_DEFINITION] = "LHS of '=' must be a variable or function",
+    [LG_ERR_NESTED_DEFINITION] = "definitions are only allowed at the top level",
+    [LG_ERR_REDEFINED_BUILTIN] = "cannot redefine built-in name",
+    [LG_ERR_BAD_PARAMETER] = "parameter must be a name",
+    [LG_ERR_DUPLICATE_PARAMETER] = "duplicate parameter",
+    [LG_ERR_UNRESOLVED_NAME] = "could not resolve name",
+    [LG_ERR_NOT_A_VARIABLE] = "function used as a variable",
+    [LG_ERR_WRONG_NUM_ARGS] = "wrong number of arguments",
+    [LG_ERR_CIRCULAR_DEFINITION] = "circular definition",
+    [LG_ERR_NOT_A_DEFINITION] = "expected a definition"
+};
+
+// whether errors are also printed to the terminal
+static atomic_bool error_print = true;
+
+const char* error_msg(int code) {
+    return error_msgs[code];
+}
+
+void error_set_print(bool print) {
+    atomic_store(&error_print, print);
+}
+
+// render an error into a buffer and write it out at once
+// from counts the parentheses the source is read as wrapped in
+static void prettyprint(const char* str_msg, const char* src, int src_len, int from, int len) {
+    char* buf;
+    size_t size;
+    FILE* f = open_memstream(&buf, &size);
+    if (f == NULL)
+        return;
+
+    fprintf(f, "\033[0;31;1merror:\033[0m %s\n", str_msg);
+    fprintf(f, "\033[0;32;1mhere:\033[0m  ");
 
     // print expression with bad portion highlighted in red
-    for (int i = 1; i < from; i++)
-        putchar(str_expr[i]);
-    printf("\033[0;31;1m");
-    for (int i = from; i < from+len; i++)
-        putchar(str_expr[i]);
-    printf("\033[0m");
-    for (int i = from + len; str_expr[i + 1] != '\0'; i++)
-        putchar(str_expr[i]);
-    printf("\n\033[0;31m");
+    int start = from - 1 < 0 ? 0 : from - 1 > src_len ? src_len : from - 1;
+    int bad = start + len > src_len ? src_len - start : len;
+    fprintf(f, "%.*s", start, src);
+    fprintf(f, "\033[0;31;1m%.*s\033[0m", bad, src + start);
+    fprintf(f, "%.*s", src_len - start - bad, src + start + bad);
+    fprintf(f, "\n\033[0;31m");
 
     // draw squiggly line under error
-    for (int i = 0; i < 6 + from; i++)
-        printf(" ");
-    printf("^");
+    fprintf(f, "%*s^", 6 + from, "");
     for (int i = 0; i < len - 1; i++)
-        printf("~");
-    printf("\033[0m\n");
+        fputc('~', f);
+    fprintf(f, "\033[0m\n");
+
+    fclose(f);
+    fwrite(buf, 1, size, stdout);
+    free(buf);
+}
+
+// record an error spanning len characters from position from of the
+// expression string, which includes the parentheses added around it
+static void error_at(int code, expr_t* expr, int from, int len) {
+    if (expr->diags) {
+        diag_t d = {
+            .code = code,
+            .pos = from - 1,
+            .len = len,
+            .msg = error_msgs[code]
+        };
+        vec_push(expr->diags, d);
+    }
+    if (atomic_load(&error_print))
+        prettyprint(error_msgs[code], expr->src, expr->src_len, from, len);
+}
+
+void error_at_pos(int code, expr_t* expr, int pos) {
+    error_at(code, expr, pos, 1);
 }
 
-void error_at_pos(const char* str, expr_t* expr, int pos) {
-    prettyprint(str, expr->fn_str, pos, 1);
+void error_at_span(int code, expr_t* expr, ast_span_t span) {
+    error_at(code, expr, span.pos, span.len);
 }
 
-void error_at_token(const char* str, expr_t* expr, token_t* tk) {
+// a NULL token means the end of the expression
+void error_at_token(int code, expr_t* expr, token_t* tk) {
     if (tk)
-        prettyprint(str, expr->fn_str, tk->str_pos, tk->str_len);
+        error_at(code, expr, tk->str_pos, tk->str_len);
     else
-        prettyprint(str, expr->fn_str, strlen(str) - 2, 0);
+        error_at(code, expr, expr->src_len + 1, 0);
 }
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
+#include "interface.h"
 #include "expression.h"
 #include "parsing/tokens.h"
 #include "parsing/ast.h"
 
-void error_at_token(const char* str, expr_t* expr, token_t* tk);
-void error_at_pos(const char* str, expr_t* expr, int pos);
+void error_at_token(int code, expr_t* expr, token_t* tk);
+void error_at_pos(int code, expr_t* expr, int pos);
+void error_at_span(int code, expr_t* expr, ast_span_t span);
+void error_set_print(bool print);
+const char* error_msg(int code);
@@ -1,43 +1,364 @@
 #include <string.h>
+#include <math.h>
+#include <stdatomic.h>
 #include "expression.h"
-#include "utils/hashmap.h"
+#include "utils/intern.h"
 #include "parsing/tokens.h"
 #include "parsing/ast.h"
 #include "parsing/parser.h"
 #include "runtime/rt.h"
+#include "utils/pool.h"
+#include "plotting/grid.h"
 
-expr_t* expr_compile(const char* str) {
-    // add parentheses before and after string for
-    // easier processing
-    char* pstr = tmalloc(strlen(str) + 3);
-    sprintf(pstr, "(%s)", str);
+static atomic_uint_fast64_t generations;
+
+// make an expression of len characters of str, not parsed yet
+static expr_t* expr_new(const char* str, size_t len, bool copy, diag_list_t* diags) {
+    const char* src = str;
+    if (copy) {
+        char* buf = tmalloc(len + 1);
+        memcpy(buf, str, len);
+        buf[len] = '\0';
+        src = buf;
+    }
 
     // allocate space for expression data
     expr_t* expr = tmalloc(sizeof(expr_t));
     *expr = (expr_t) {
-        .fn_str = pstr,
-        .name_table = hm_create(HASHMAP_SIZE_DEFAULT),
+        .src = src,
+        .src_len = len,
+        .src_owned = copy,
+        .lexed = vec_new(token_t),
         .tokens = { 
             .num_tokens = 0,
             .first = NULL,
             .last = NULL
         },
-        .ast_root = NULL
+        .prog = NULL,
+        .approx = NULL,
+        .deps = vec_new(expr_dep_t),
+        .generation = atomic_fetch_add(&generations, 1),
+        .diags = diags
     };
+    return expr;
+}
+
+// parse the lexed tokens of an expression
+static int parse(expr_t* expr) {
+    if (parser_tokenize(expr) == -1)
+        return -1;
+    return parser_make_ast(expr);
+}
+
+// tokenize and parse len characters of str, returns NULL on error
+// unless copy is set, the expression reads its source from str
+// instead of keeping a copy, so str must outlive it
+// problems are recorded into diags if it isn't NULL
+expr_t* expr_parse(const char* str, size_t len, bool copy, diag_list_t* diags) {
+    expr_t* expr = expr_new(str, len, copy, diags);
+    parser_lex(expr);
+    if (parse(expr) == -1) {
+        expr_free(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// parse the source of base with bytes [pos, pos + old_len) replaced,
+// giving str, in which the replacement is bytes [pos, pos + new_len)
+// only the tokens around the edit are lexed again. *out receives the
+// new expression even if it fails to parse, in which case it returns
+// -1 and *out only serves as the base of the next edit
+int expr_edit(const expr_t* base, const char* str, size_t len, int pos, int old_len, int new_len,
+              diag_list_t* diags, expr_t** out) {
+    expr_t* expr = expr_new(str, len, true, diags);
+    *out = expr;
+
+    // lex it all if the edit doesn't match the sources
+    bool valid = pos >= 0 && old_len >= 0 && new_len >= 0
+        && (size_t)(pos + old_len) <= base->src_len && (size_t)(pos + new_len) <= len
+        && base->src_len - old_len == len - new_len;
+    if (valid)
+        parser_relex(expr, base, pos, old_len, new_len);
+    else
+        parser_lex(expr);
+
+    return parse(expr);
+}
+
+// check whether two expressions compiled to the same program
+bool expr_same_prog(const expr_t* a, const expr_t* b) {
+    if (a->prog == NULL || b->prog == NULL)
+        return a->prog == b->prog;
+
+    const ir_prog_t *p = a->prog, *q = b->prog;
+    if (p->insts.len != q->insts.len || p->args.len != q->args.len)
+        return false;
+    if (memcmp(p->args.data, q->args.data, p->args.len * sizeof(uint32_t)) != 0)
+        return false;
+    for (size_t i = 0; i < p->insts.len; i++) {
+        const ir_inst_t *x = &(p->insts.data[i]), *y = &(q->insts.data[i]);
+        if (x->op != y->op || x->num_args != y->num_args || x->args != y->args)
+            return false;
+        if (x->op == IR_CONST && memcmp(&(x->imm), &(y->imm), sizeof(float)) != 0)
+            return false;
+        if ((x->op == IR_INPUT && x->input != y->input) || (x->op == IR_CALL && x->fn != y->fn))
+            return false;
+    }
+    return true;
+}
+
+// free an expression and everything it owns
+void expr_free(expr_t* expr) {
+    if (expr == NULL)
+        return;
+
+    parser_free_tokens(expr);
+    vec_destruct(&(expr->lexed));
+    if (expr->ast.nodes.data)
+        ast_destroy(&(expr->ast));
+    if (expr->prog) {
+        ir_counter_t* counters = atomic_load(&(expr->prog->counters));
+        if (counters)
+            tfree(counters);
+        vec_destruct(&(expr->prog->insts));
+        vec_destruct(&(expr->prog->args));
+        tfree(expr->prog);
+    }
+    if (expr->approx)
+        cheb_free(expr->approx);
+    vec_destruct(&(expr->deps));
+    if (expr->src_owned)
+        tfree((char*)expr->src);
+    tfree(expr);
+}
+
+// bytes held by an expression
+// definitions it registered belong to the runtime, not to it
+size_t expr_size(const expr_t* expr) {
+    size_t size = sizeof(expr_t) + (expr->src_owned ? expr->src_len + 1 : 0);
+    size += expr->ast.nodes.alloc_size + expr->ast.kids.alloc_size + expr->ast.spans.alloc_size;
+    size += expr->deps.alloc_size + expr->lexed.alloc_size;
+    if (expr->prog)
+        size += sizeof(ir_prog_t) + expr->prog->insts.alloc_size + expr->prog->args.alloc_size;
+    if (expr->approx)
+        size += cheb_size(expr->approx);
+    return size;
+}
 
-    // parse the expression
-    if (parser_tokenize(expr) == -1 )
-        goto fail;
-    
-    if (parser_make_ast(expr) == -1)
-        goto fail;
+// check whether a parsed expression is a definition
+bool expr_is_def(const expr_t* expr) {
+    return ast_is_def(&(expr->ast));
+}
 
+// resolve the names in a parsed expression
+// definitions become available to later expressions right away
+int expr_resolve(expr_t* expr) {
     if (rt_resolve(expr) == -1)
-        goto fail;
-        
-    // TODO: IR and machine code generation
+        return -1;
+
+    // definitions keep calls to other definitions, so
+    // save the body before they get expanded
+    if (expr_is_def(expr)) {
+        const ast_t* ast = &(expr->ast);
+        const ast_node_t* root = AST_NODE(ast, AST_ROOT(ast));
+        const ast_node_t* lhs = AST_NODE(ast, AST_CHILD(ast, root, 0));
+
+        ast_t* body = tmalloc(sizeof(ast_t));
+        ast_slice(ast, AST_CHILD(ast, root, 1), body);
+        rt_define(intern_str(lhs->name_id), lhs->num_children, body);
+    }
+    return 0;
+}
+
+// generate the program of a resolved expression
+// this only reads the runtime, so expressions can be built in parallel
+int expr_build(expr_t* expr) {
+    if (rt_expand(expr) == -1)
+        return -1;
+
+    if (rt_lower(expr) == -1)
+        return -1;
+
+    // the optimized program is what gets evaluated, by the
+    // interpreter in runtime/eval.c
+    if (rt_optimize(expr) == -1)
+        return -1;
+
+    expr->diags = NULL;
+    return 0;
+}
+
+// compile an expression, returns NULL on error
+// problems are recorded into diags if it isn't NULL
+expr_t* expr_compile(const char* str, size_t len, diag_list_t* diags) {
+    expr_t* expr = expr_parse(str, len, true, diags);
+    if (expr == NULL)
+        return NULL;
+
+    if (expr_resolve(expr) == -1 || expr_build(expr) == -1) {
+        expr_free(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// check whether any user-defined function the expression
+// was compiled with has been redefined since
+bool expr_stale(const expr_t* expr) {
+    for (size_t i = 0; i < expr->deps.len; i++) {
+        const expr_dep_t* d = &(expr->deps.data[i]);
+        if (d->fn->version != d->version)
+            return true;
+    }
+    return false;
+}
+
+// compile the source of an expression again, with the current
+// definitions. a definition isn't registered again, since that would
+// undo any later redefinition of its name
+expr_t* expr_recompile(const expr_t* expr) {
+    expr_t* new_expr = expr_parse(expr->src, expr->src_len, true, NULL);
+    if (new_expr == NULL)
+        return NULL;
+
+    if (rt_resolve(new_expr) == -1 || expr_build(new_expr) == -1) {
+        expr_free(new_expr);
+        return NULL;
+    }
+    return new_expr;
+}
+
+// evaluate a compiled expression at a point
+float expr_eval(expr_t* expr, float x, float y) {
+    if (expr == NULL || expr->prog == NULL)
+        return NAN;
+
+    if (expr->approx && cheb_covers(expr->approx, x))
+        return cheb_eval(expr->approx, x);
+
+    float inputs[RT_NUM_INPUTS] = { x, y };
+    return rt_eval(expr->prog, inputs);
+}
+
+// replace the program of a compiled expression in x by an approximation
+// to within tol over [x0, x1], dropping any earlier one
+// returns the number of pieces, or -1 if it can't be approximated
+int expr_approximate(expr_t* expr, float x0, float x1, float tol) {
+    if (expr->approx)
+        cheb_free(expr->approx);
+    expr->approx = expr->prog ? cheb_fit(expr->prog, x0, x1, tol) : NULL;
+    return expr->approx ? (int)expr->approx->pieces.len : -1;
+}
+
+// points evaluated by each batch task
+#define BATCH_GRAIN (16 * RT_BLOCK_SIZE)
+
+struct batch {
+    const ir_prog_t* prog;
+    const cheb_t* approx;
+    const float *xs, *ys;
+    float* out;
+};
+
+static void batch_range(void* ctx, size_t begin, size_t end) {
+    struct batch* b = ctx;
+    if (b->approx && b->xs) {
+        // points outside the approximation's domain are rare,
+        // so they are done one by one afterwards
+        cheb_eval_batch(b->approx, b->xs + begin, b->out + begin, end - begin);
+        for (size_t i = begin; i < end; i++)
+            if (!cheb_covers(b->approx, b->xs[i]))
+                b->out[i] = rt_eval(b->prog, (float[RT_NUM_INPUTS]) { b->xs[i], 0 });
+        return;
+    }
+
+    const float* inputs[RT_NUM_INPUTS] = {
+        b->xs ? b->xs + begin : NULL,
+        b->ys ? b->ys + begin : NULL
+    };
+    rt_eval_batch(b->prog, inputs, b->out + begin, end - begin);
+}
+
+// evaluate a compiled expression at n points
+void expr_eval_batch(expr_t* expr, const float* xs, const float* ys, float* out, size_t n) {
+    if (expr == NULL || expr->prog == NULL) {
+        for (size_t i = 0; i < n; i++)
+            out[i] = NAN;
+        return;
+    }
+
+    struct batch b = { .prog = expr->prog, .approx = expr->approx, .xs = xs, .ys = ys, .out = out };
+    pool_for(n, BATCH_GRAIN, &batch_range, &b);
+}
+
+struct fused_batch {
+    const ir_prog_t* prog;
+    const uint32_t* results;
+    size_t num_results;
+    const float *xs, *ys;
+    float** outs;
+};
+
+static void fused_range(void* ctx, size_t begin, size_t end) {
+    struct fused_batch* b = ctx;
+    const float* inputs[RT_NUM_INPUTS] = {
+        b->xs ? b->xs + begin : NULL,
+        b->ys ? b->ys + begin : NULL
+    };
+    float* outs[b->num_results];
+    for (size_t k = 0; k < b->num_results; k++)
+        outs[k] = b->outs[k] + begin;
+    rt_eval_batch_multi(b->prog, b->results, b->num_results, inputs, outs, end - begin);
+}
+
+// evaluate several compiled expressions at the same n points, into
+// outs[i] for exprs[i]. their programs are fused into one, so inputs
+// and common subexpressions are only computed once per point
+void expr_eval_batch_many(expr_t* const exprs[], size_t num_exprs, const float* xs, const float* ys,
+                          float* outs[], size_t n) {
+    const ir_prog_t** progs = tmalloc(num_exprs * sizeof(ir_prog_t*));
+    float** fused_outs = tmalloc(num_exprs * sizeof(float*));
+    size_t num_fused = 0;
+    for (size_t i = 0; i < num_exprs; i++) {
+        expr_t* expr = exprs[i];
+
+        // approximations are cheaper than anything fusing saves
+        if (expr == NULL || expr->prog == NULL || expr->approx) {
+            expr_eval_batch(expr, xs, ys, outs[i], n);
+            continue;
+        }
+        progs[num_fused] = expr->prog;
+        fused_outs[num_fused++] = outs[i];
+    }
+
+    if (num_fused > 0) {
+        uint32_t* results = tmalloc(num_fused * sizeof(uint32_t));
+        ir_prog_t* prog = rt_fuse(progs, num_fused, results);
+        struct fused_batch b = {
+            .prog = prog,
+            .results = results, .num_results = num_fused,
+            .xs = xs, .ys = ys,
+            .outs = fused_outs
+        };
+        pool_for(n, BATCH_GRAIN, &fused_range, &b);
+
+        vec_destruct(&(prog->insts));
+        vec_destruct(&(prog->args));
+        tfree(prog);
+        tfree(results);
+    }
+    tfree(progs);
+    tfree(fused_outs);
+}
 
-fail:
-    // TODO: deallocate here
-    return NULL;
+// evaluate a compiled expression at the cells of a grid
+void expr_eval_grid(expr_t* expr, const grid_t* grid, float* out, size_t stride) {
+    if (expr == NULL || expr->prog == NULL) {
+        for (size_t j = 0; j < grid->height; j++)
+            for (size_t i = 0; i < grid->width; i++)
+                out[j*stride + i] = NAN;
+        return;
+    }
+    grid_eval(expr->prog, grid, out, stride);
 }
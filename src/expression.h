@@ -3,13 +3,71 @@
 #include "utils/hashmap.h"
 #include "parsing/tokens.h"
 #include "parsing/ast.h"
+#include "runtime/ir.h"
+#include "runtime/cheb.h"
+#include "plotting/grid.h"
+
+struct function;
+
+// a problem found while compiling an expression
+typedef struct {
+    int code;
+
+    // span in the source string
+    int pos, len;
+    const char* msg;
+} diag_t;
+
+typedef vec_struct(diag_t) diag_list_t;
+
+// a user-defined function an expression was compiled with
+typedef struct {
+    const struct function* fn;
+    uint32_t version;
+} expr_dep_t;
 
 typedef struct {
-    const char* fn_str;
-    hashmap_t* name_table;
+    // source string, not necessarily null-terminated
+    const char* src;
+    size_t src_len;
+    bool src_owned;
+
+    lexed_t lexed;
     tokenlist_t tokens;
-    ast_node_t* ast_root;
+    ast_t ast;
+
+    // compiled program, NULL if the expression has no value
+    ir_prog_t* prog;
+
+    // used in place of the program within its domain, may be NULL
+    cheb_t* approx;
+
+    // user-defined functions inlined into the program
+    vec_struct(expr_dep_t) deps;
+
+    // unique for every compilation
+    uint64_t generation;
+
+    // where to record problems, may be NULL
+    diag_list_t* diags;
 } expr_t;
 
-expr_t* expr_compile(const char* str);
+expr_t* expr_parse(const char* str, size_t len, bool copy, diag_list_t* diags);
+int expr_edit(const expr_t* base, const char* str, size_t len, int pos, int old_len, int new_len,
+              diag_list_t* diags, expr_t** out);
+bool expr_same_prog(const expr_t* a, const expr_t* b);
+bool expr_is_def(const expr_t* expr);
+int expr_resolve(expr_t* expr);
+int expr_build(expr_t* expr);
+expr_t* expr_compile(const char* str, size_t len, diag_list_t* diags);
+void expr_free(expr_t* expr);
+size_t expr_size(const expr_t* expr);
+bool expr_stale(const expr_t* expr);
+expr_t* expr_recompile(const expr_t* expr);
+float expr_eval(expr_t* expr, float x, float y);
+int expr_approximate(expr_t* expr, float x0, float x1, float tol);
+void expr_eval_batch(expr_t* expr, const float* xs, const float* ys, float* out, size_t n);
+void expr_eval_batch_many(expr_t* const exprs[], size_t num_exprs, const float* xs, const float* ys,
+                          float* outs[], size_t n);
+void expr_eval_grid(expr_t* expr, const grid_t* grid, float* out, size_t stride);
 void expr_debug(expr_t* expr);
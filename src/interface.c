@@ -4,21 +4,875 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "interface.h"
+#include "error.h"
 #include "expression.h"
 #include "runtime/rt.h"
 #include "utils/tmalloc.h"
+#include "utils/vector.h"
+#include "utils/pool.h"
+#include "utils/worker.h"
+#include "plotting/tcache.h"
+#include "plotting/roots.h"
+#include "plotting/integrate.h"
+#include "plotting/polyline.h"
+#include "plotting/raster.h"
+
+// all successfully loaded expressions, indexed by handle
+// freed ones are NULL, and their handles are reused. like everything
+// indexed by handle, only the thread calling the library touches it
+static vec_struct(expr_t*) exprs;
+static vec_struct(lg_handle_t) free_ids;
+
+// an expression compiled in the background by lg_load_async
+struct load_job {
+    char* src;
+    lg_handle_t id;
+    void (*done)(lg_handle_t, int, void*);
+    void* user;
+
+    // LG_LOAD_PENDING until the worker is done with it,
+    // after which result is NULL if compiling failed
+    atomic_int status;
+    expr_t* result;
+    diag_list_t diags;
+
+    // held by the worker and by the handle
+    atomic_int refs;
+
+    // set when the handle is freed while compiling, only
+    // touched by the thread the handle is used from
+    bool freed;
+};
+
+// jobs whose result hasn't been taken yet, indexed by handle like exprs
+// failed ones stay until their handle is freed
+static vec_struct(struct load_job*) jobs;
+
+// handles freed while still compiling, given out again once done
+static vec_struct(lg_handle_t) orphans;
+
+// the latest source of handles whose last edit didn't compile,
+// indexed by handle like exprs
+static vec_struct(expr_t*) drafts;
+
+// the runtime is changed with this held for writing, and
+// looked at with it held for reading, so background
+// compiles can go on alongside everything else
+static pthread_rwlock_t rt_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// problems found by the last compile
+static diag_list_t last_diags;
+
+// problems found by the last lg_load_many,
+// one list per expression
+static vec_struct(diag_list_t) batch_diags;
 
 [[gnu::visibility("default")]] void lg_init(void) {
     rt_init();
+    pool_init(0);
+    exprs = (typeof(exprs)) vec_new(expr_t*);
+    free_ids = (typeof(free_ids)) vec_new(lg_handle_t);
+    jobs = (typeof(jobs)) vec_new(struct load_job*);
+    orphans = (typeof(orphans)) vec_new(lg_handle_t);
+    drafts = (typeof(drafts)) vec_new(expr_t*);
+}
+
+// set the number of threads used for evaluation, 0 meaning one per
+// processor. must not be called while anything is being evaluated
+[[gnu::visibility("default")]] void lg_set_threads(int num_threads) {
+    pool_shutdown();
+    pool_init(num_threads);
+}
+
+static void job_release(struct load_job* job) {
+    if (atomic_fetch_sub_explicit(&(job->refs), 1, memory_order_acq_rel) > 1)
+        return;
+
+    if (job->result)
+        expr_free(job->result);
+    vec_destruct(&(job->diags));
+    tfree(job->src);
+    tfree(job);
+}
+
+// release a handle, which must not hold an expression anymore
+static void drop_handle(lg_handle_t id) {
+    if (jobs.data[id]) {
+        job_release(jobs.data[id]);
+        jobs.data[id] = NULL;
+    }
+    if (drafts.data[id]) {
+        expr_free(drafts.data[id]);
+        drafts.data[id] = NULL;
+    }
+    exprs.data[id] = NULL;
+    vec_push(&free_ids, id);
+    tcache_invalidate(id);
+}
+
+// take the result of a finished background compile
+// a handle whose compile failed keeps its job until it is freed
+static void collect_job(lg_handle_t id) {
+    struct load_job* job = jobs.data[id];
+    if (job->freed || atomic_load_explicit(&(job->status), memory_order_acquire) != LG_LOAD_READY)
+        return;
+
+    exprs.data[id] = job->result;
+    job->result = NULL;
+    job_release(job);
+    jobs.data[id] = NULL;
 }
 
-[[gnu::visibility("default")]] int lg_load(const char* str) {
-    expr_t* expr = expr_compile(str);
+// release the handles freed while compiling whose compile is done
+static void collect_orphans(void) {
+    for (size_t i = 0; i < orphans.len;) {
+        lg_handle_t id = orphans.data[i];
+        if (atomic_load_explicit(&(jobs.data[id]->status), memory_order_acquire) == LG_LOAD_PENDING) {
+            i++;
+            continue;
+        }
+        drop_handle(id);
+        orphans.data[i] = orphans.data[--orphans.len];
+    }
+}
+
+// get a loaded expression, NULL if the id is invalid
+// or its compile hasn't finished yet
+// expressions compiled with definitions that have changed since
+// are compiled again, keeping their last good version on failure
+static expr_t* get_expr(lg_handle_t id) {
+    if (id < 0 || (size_t)id >= exprs.len)
+        return NULL;
+    if (jobs.data[id])
+        collect_job(id);
+
+    expr_t* expr = exprs.data[id];
+    if (expr == NULL)
+        return NULL;
+
+    pthread_rwlock_rdlock(&rt_lock);
+    bool stale = expr_stale(expr);
+    pthread_rwlock_unlock(&rt_lock);
+    if (!stale)
+        return expr;
+
+    // recompiling leaves definitions alone, so it only reads the runtime
+    pthread_rwlock_rdlock(&rt_lock);
+    expr_t* new_expr = expr_recompile(expr);
+    if (new_expr == NULL) {
+        // don't try again until something else changes
+        for (size_t i = 0; i < expr->deps.len; i++)
+            expr->deps.data[i].version = expr->deps.data[i].fn->version;
+    }
+    pthread_rwlock_unlock(&rt_lock);
+    if (new_expr == NULL)
+        return expr;
+
+    // approximations are fitted again to the new program
+    if (expr->approx)
+        expr_approximate(new_expr, expr->approx->x0, expr->approx->x1, expr->approx->tol);
+
+    exprs.data[id] = new_expr;
+    expr_free(expr);
+    tcache_invalidate(id);
+    return new_expr;
+}
+
+// give a loaded expression a handle
+static lg_handle_t add_expr(expr_t* expr) {
+    collect_orphans();
+    if (free_ids.len > 0) {
+        lg_handle_t id = free_ids.data[--free_ids.len];
+        exprs.data[id] = expr;
+        return id;
+    }
+    vec_push(&exprs, expr);
+    vec_push(&jobs, NULL);
+    vec_push(&drafts, NULL);
+    return exprs.len - 1;
+}
+
+// resolve and build a parsed expression. the runtime is only held for
+// writing while a definition registers itself, and building just reads
+// it, so evaluation on other threads doesn't wait for the build
+// the expression is kept on failure
+static int build_parsed(expr_t* expr) {
+    bool def = expr_is_def(expr);
+    if (def) {
+        pthread_rwlock_wrlock(&rt_lock);
+        int res = expr_resolve(expr);
+        pthread_rwlock_unlock(&rt_lock);
+        if (res == -1)
+            return -1;
+    }
+
+    // definitions made in between are caught by expansion
+    pthread_rwlock_rdlock(&rt_lock);
+    int res = (!def && expr_resolve(expr) == -1) || expr_build(expr) == -1 ? -1 : 0;
+    pthread_rwlock_unlock(&rt_lock);
+    return res;
+}
+
+// parse and build an expression, returns NULL on error
+static expr_t* compile(const char* str, diag_list_t* diags) {
+    expr_t* expr = expr_parse(str, strlen(str), true, diags);
+    if (expr && build_parsed(expr) == -1) {
+        expr_free(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+// returns a handle for the expression, or -1 on error
+[[gnu::visibility("default")]] lg_handle_t lg_load(const char* str) {
+    if (last_diags.data == NULL)
+        last_diags = (diag_list_t) vec_new(diag_t);
+    last_diags.len = 0;
+
+    expr_t* expr = compile(str, &last_diags);
     if (expr == NULL)
         return -1;
-    
-    // TODO: book-keeping here
+    return add_expr(expr);
+}
+
+static void compile_job(void* arg) {
+    struct load_job* job = arg;
+    expr_t* expr = compile(job->src, &(job->diags));
+
+    job->result = expr;
+    atomic_store_explicit(&(job->status), expr ? LG_LOAD_READY : LG_LOAD_FAILED, memory_order_release);
+    if (job->done)
+        job->done(job->id, expr != NULL, job->user);
+    job_release(job);
+}
+
+// start compiling an expression on a background thread and return its
+// handle right away. until it is done, the handle evaluates like a failed
+// one, and lg_load_status tells how it went. if done isn't NULL, it is
+// called on the background thread once compiling finishes, with ok
+// set if it succeeded, and must not call into the library. the handle
+// stays taken until lg_free, even if its compile failed
+[[gnu::visibility("default")]] lg_handle_t lg_load_async(const char* str,
+                                                         void (*done)(lg_handle_t id, int ok, void* user),
+                                                         void* user) {
+    struct load_job* job = tmalloc(sizeof(struct load_job));
+    size_t len = strlen(str);
+    job->src = tmalloc(len + 1);
+    memcpy(job->src, str, len + 1);
+    job->done = done;
+    job->user = user;
+    job->result = NULL;
+    job->diags = (diag_list_t) vec_new(diag_t);
+    atomic_init(&(job->status), LG_LOAD_PENDING);
+    atomic_init(&(job->refs), 2);
+    job->freed = false;
+
+    job->id = add_expr(NULL);
+    jobs.data[job->id] = job;
+    worker_submit(&compile_job, job);
+    return job->id;
+}
+
+// check on an expression loaded by lg_load_async: LG_LOAD_READY once it
+// can be used, LG_LOAD_PENDING while compiling, LG_LOAD_FAILED if it
+// couldn't be compiled or the handle is invalid
+[[gnu::visibility("default")]] int lg_load_status(lg_handle_t id) {
+    if (id < 0 || (size_t)id >= exprs.len)
+        return LG_LOAD_FAILED;
+    struct load_job* job = jobs.data[id];
+    if (job) {
+        if (job->freed)
+            return LG_LOAD_FAILED;
+        if (atomic_load_explicit(&(job->status), memory_order_acquire) == LG_LOAD_PENDING)
+            return LG_LOAD_PENDING;
+        collect_job(id);
+    }
+    return exprs.data[id] ? LG_LOAD_READY : LG_LOAD_FAILED;
+}
 
+// get the problems found compiling an expression loaded by lg_load_async
+// the list stays valid until the handle is freed, and is empty while
+// compiling, once the expression is ready, or if the handle is invalid
+[[gnu::visibility("default")]] size_t lg_load_diagnostics(lg_handle_t id, const lg_diag_t** diags) {
+    *diags = NULL;
+    if (id < 0 || (size_t)id >= exprs.len || jobs.data[id] == NULL || jobs.data[id]->freed)
+        return 0;
+
+    struct load_job* job = jobs.data[id];
+    if (atomic_load_explicit(&(job->status), memory_order_acquire) == LG_LOAD_PENDING)
+        return 0;
+    *diags = (const lg_diag_t*)job->diags.data;
+    return job->diags.len;
+}
+
+// release a loaded expression and its cached tiles
+// definitions it made stay in place. a background compile still
+// running is left to finish on its own, and only then is the
+// handle given out again
+[[gnu::visibility("default")]] void lg_free(lg_handle_t id) {
+    if (id < 0 || (size_t)id >= exprs.len)
+        return;
+    struct load_job* job = jobs.data[id];
+    if ((job == NULL && exprs.data[id] == NULL) || (job && job->freed))
+        return;
+
+    if (job && atomic_load_explicit(&(job->status), memory_order_acquire) == LG_LOAD_PENDING) {
+        job->freed = true;
+        vec_push(&orphans, id);
+        return;
+    }
+
+    if (exprs.data[id])
+        expr_free(exprs.data[id]);
+    drop_handle(id);
+}
+
+// change the source of a loaded expression as it is being typed: str
+// is its new source, in which bytes [pos, pos + new_len) replaced bytes
+// [pos, pos + old_len) of the last source it was given. only the
+// tokens around the edit are lexed again, and if the program doesn't
+// change, cached tiles are kept. if the new source doesn't compile, the
+// expression keeps its last good program, while later edits still
+// apply to the new source. problems found are available from
+// lg_diagnostics. returns -1 if the edit didn't compile or the
+// handle is invalid
+[[gnu::visibility("default")]] int lg_edit(lg_handle_t id, const char* str, int pos, int old_len, int new_len) {
+    if (last_diags.data == NULL)
+        last_diags = (diag_list_t) vec_new(diag_t);
+    last_diags.len = 0;
+
+    expr_t* expr = get_expr(id);
+    if (expr == NULL)
+        return -1;
+    const expr_t* base = drafts.data[id] ? drafts.data[id] : expr;
+
+    expr_t* next;
+    int res = expr_edit(base, str, strlen(str), pos, old_len, new_len, &last_diags, &next);
+    if (res != -1)
+        res = build_parsed(next);
+    next->diags = NULL;
+
+    if (drafts.data[id])
+        expr_free(drafts.data[id]);
+    drafts.data[id] = NULL;
+    if (res == -1) {
+        drafts.data[id] = next;
+        return -1;
+    }
+
+    // an unchanged program keeps its tiles, counts and approximation
+    if (expr_same_prog(expr, next)) {
+        next->generation = expr->generation;
+        if (expr->prog && next->prog) {
+            ir_counter_t* counters = atomic_exchange(&(expr->prog->counters), NULL);
+            atomic_store(&(next->prog->counters), counters);
+        }
+        next->approx = expr->approx;
+        expr->approx = NULL;
+    } else {
+        if (expr->approx)
+            expr_approximate(next, expr->approx->x0, expr->approx->x1, expr->approx->tol);
+        tcache_invalidate(id);
+    }
+    exprs.data[id] = next;
+    expr_free(expr);
     return 0;
 }
+
+// expressions compiled together by lg_load_many and lg_load_file
+struct load_batch {
+    const char** srcs;
+
+    // lengths of the sources if they aren't null-terminated, and
+    // whether the expressions need copies of them
+    const size_t* lens;
+    bool copy;
+
+    // whether anything but definitions is rejected
+    bool defs_only;
+
+    expr_t** exprs;
+    diag_list_t* diags;
+};
+
+static void parse_range(void* ctx, size_t begin, size_t end) {
+    struct load_batch* b = ctx;
+    for (size_t i = begin; i < end; i++) {
+        size_t len = b->lens ? b->lens[i] : strlen(b->srcs[i]);
+        expr_t* expr = expr_parse(b->srcs[i], len, b->copy, &(b->diags[i]));
+        if (expr && b->defs_only && !expr_is_def(expr)) {
+            error_at_span(LG_ERR_NOT_A_DEFINITION, expr, (ast_span_t) { .pos = 1, .len = len });
+            expr_free(expr);
+            expr = NULL;
+        }
+        b->exprs[i] = expr;
+    }
+}
+
+static void build_range(void* ctx, size_t begin, size_t end) {
+    struct load_batch* b = ctx;
+    for (size_t i = begin; i < end; i++) {
+        expr_t* expr = b->exprs[i];
+        if (expr == NULL)
+            continue;
+        if ((!expr_is_def(expr) && expr_resolve(expr) == -1) || expr_build(expr) == -1) {
+            expr_free(expr);
+            b->exprs[i] = NULL;
+        }
+    }
+}
+
+// compile n expressions in parallel, leaving NULL for the failed ones
+// definitions are registered in order before anything else is
+// resolved, so every expression sees the batch's final definitions
+static void compile_batch(struct load_batch* b, size_t n) {
+    // parsing only touches the expressions themselves
+    pool_for(n, 16, &parse_range, b);
+
+    // definitions change the runtime, so they are resolved one at a time
+    pthread_rwlock_wrlock(&rt_lock);
+    for (size_t i = 0; i < n; i++)
+        if (b->exprs[i] && expr_is_def(b->exprs[i]) && expr_resolve(b->exprs[i]) == -1) {
+            expr_free(b->exprs[i]);
+            b->exprs[i] = NULL;
+        }
+    pthread_rwlock_unlock(&rt_lock);
+
+    // building only reads the runtime, so the batch can be built in parallel
+    pthread_rwlock_rdlock(&rt_lock);
+    pool_for(n, 16, &build_range, b);
+    pthread_rwlock_unlock(&rt_lock);
+}
+
+// load n expressions at once, compiling them in parallel
+// ids[i] receives the id of srcs[i], or -1 on error. if diags and num_diags
+// aren't NULL, they receive the problems found in each expression, which
+// stay valid until the next lg_load_many
+// definitions in the batch are registered in order before anything else
+// is resolved, so every expression sees the batch's final definitions
+// returns the number of expressions loaded
+[[gnu::visibility("default")]] size_t lg_load_many(const char** srcs, size_t n, lg_handle_t* ids,
+                                                  const lg_diag_t** diags, size_t* num_diags) {
+    // reuse the lists from the last batch
+    for (size_t i = 0; i < batch_diags.len; i++)
+        batch_diags.data[i].len = 0;
+    while (batch_diags.len < n)
+        vec_push(&batch_diags, ((diag_list_t) vec_new(diag_t)));
+
+    expr_t** batch = tmalloc(n * sizeof(expr_t*));
+    struct load_batch b = {
+        .srcs = srcs, .lens = NULL, .copy = true, .defs_only = false,
+        .exprs = batch, .diags = batch_diags.data
+    };
+    compile_batch(&b, n);
+
+    size_t loaded = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (batch[i]) {
+            ids[i] = add_expr(batch[i]);
+            loaded++;
+        } else
+            ids[i] = -1;
+
+        if (diags && num_diags) {
+            diags[i] = (const lg_diag_t*)batch_diags.data[i].data;
+            num_diags[i] = batch_diags.data[i].len;
+        }
+    }
+    tfree(batch);
+    return loaded;
+}
+
+// load a file of definitions, one per line, compiling them like
+// lg_load_many. lines are read straight from a mapping of the file,
+// and blank ones are skipped. lines that aren't definitions are
+// reported as problems, which are available from lg_diagnostics,
+// with positions counted from the start of the file
+// returns the number of definitions loaded, or -1 if the file can't be read
+[[gnu::visibility("default")]] int lg_load_file(const char* path) {
+    if (last_diags.data == NULL)
+        last_diags = (diag_list_t) vec_new(diag_t);
+    last_diags.len = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    const char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise((void*)map, size, MADV_WILLNEED);
+
+    // find the lines, without their line endings
+    vec_struct(const char*) srcs = vec_new(const char*);
+    vec_struct(size_t) lens = vec_new(size_t);
+    for (const char* line = map; line < map + size;) {
+        const char* nl = memchr(line, '\n', map + size - line);
+        const char* next = nl ? nl + 1 : map + size;
+        size_t len = (nl ? nl : map + size) - line;
+        if (len > 0 && line[len - 1] == '\r')
+            len--;
+
+        bool blank = true;
+        for (size_t i = 0; blank && i < len; i++)
+            blank = isspace((unsigned char)line[i]);
+        if (!blank) {
+            vec_push(&srcs, line);
+            vec_push(&lens, len);
+        }
+        line = next;
+    }
+
+    // lines rarely have problems, so their lists start out empty
+    size_t n = srcs.len;
+    expr_t** batch = tmalloc(n * sizeof(expr_t*));
+    diag_list_t* diags = tmalloc(n * sizeof(diag_list_t));
+    memset(diags, 0, n * sizeof(diag_list_t));
+    struct load_batch b = {
+        .srcs = srcs.data, .lens = lens.data, .copy = false, .defs_only = true,
+        .exprs = batch, .diags = diags
+    };
+    compile_batch(&b, n);
+
+    // definitions stay registered, but the expressions read from
+    // the mapping, so they go before it does
+    int loaded = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (batch[i]) {
+            expr_free(batch[i]);
+            loaded++;
+        }
+        if (diags[i].data) {
+            for (size_t j = 0; j < diags[i].len; j++) {
+                diag_t d = diags[i].data[j];
+                d.pos += srcs.data[i] - map;
+                vec_push(&last_diags, d);
+            }
+            vec_destruct(&(diags[i]));
+        }
+    }
+
+    tfree(diags);
+    tfree(batch);
+    vec_destruct(&srcs);
+    vec_destruct(&lens);
+    munmap((void*)map, size);
+    return loaded;
+}
+
+// get the problems found by the last lg_load
+// the list stays valid until the next lg_load
+[[gnu::visibility("default")]] size_t lg_diagnostics(const lg_diag_t** diags) {
+    static_assert(sizeof(lg_diag_t) == sizeof(diag_t));
+    *diags = (const lg_diag_t*)last_diags.data;
+    return last_diags.len;
+}
+
+// enable or disable printing compile errors to the terminal
+// they are recorded for lg_diagnostics either way
+[[gnu::visibility("default")]] void lg_set_error_output(int enabled) {
+    error_set_print(enabled);
+}
+
+// evaluate a loaded expression at a point
+// NAN if the expression has no value
+[[gnu::visibility("default")]] float lg_eval(lg_handle_t id, float x, float y) {
+    return expr_eval(get_expr(id), x, y);
+}
+
+// evaluate a loaded expression at n points (xs[i], ys[i])
+// either input array may be NULL, in which case it reads as 0
+[[gnu::visibility("default")]] void lg_eval_batch(lg_handle_t id, const float* xs, const float* ys, float* out, size_t n) {
+    expr_eval_batch(get_expr(id), xs, ys, out, n);
+}
+
+// evaluate num_ids loaded expressions at the same n points, into outs[i]
+// for ids[i], like lg_eval_batch. they are evaluated together in one
+// pass over the points, computing the inputs and anything the
+// expressions have in common only once
+[[gnu::visibility("default")]] void lg_eval_batch_many(const lg_handle_t* ids, size_t num_ids,
+                                                      const float* xs, const float* ys, float** outs, size_t n) {
+    expr_t** batch = tmalloc(num_ids * sizeof(expr_t*));
+    for (size_t i = 0; i < num_ids; i++)
+        batch[i] = get_expr(ids[i]);
+    expr_eval_batch_many(batch, num_ids, xs, ys, outs, n);
+    tfree(batch);
+}
+
+// evaluate a loaded expression over a width x height grid covering
+// [x0, x1] x [y0, y1], sampling at cell centers. row 0 is the top (y1),
+// and rows are stride floats apart in out
+[[gnu::visibility("default")]] void lg_eval_grid(lg_handle_t id, float x0, float y0, float x1, float y1,
+                                                int width, int height, float* out, size_t stride) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    grid_t grid = {
+        .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1,
+        .width = width, .height = height
+    };
+    expr_eval_grid(get_expr(id), &grid, out, stride);
+}
+
+// evaluate a width x height view at a zoom level, where pixels are 2^-zoom
+// units wide and pixel (px, py) is centered at ((px + 0.5) * 2^-zoom,
+// -(py + 0.5) * 2^-zoom). tiles from earlier views of the same expression
+// and zoom level are reused
+[[gnu::visibility("default")]] void lg_eval_view(lg_handle_t id, int zoom, int64_t px, int64_t py,
+                                                int width, int height, float* out, size_t stride) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    view_t view = {
+        .zoom = zoom,
+        .px = px, .py = py,
+        .width = width, .height = height
+    };
+    expr_t* expr = get_expr(id);
+    if (expr == NULL || expr->prog == NULL) {
+        for (int j = 0; j < height; j++)
+            for (int i = 0; i < width; i++)
+                out[j*stride + i] = NAN;
+        return;
+    }
+    tcache_eval_view(id, expr->generation, expr->prog, &view, out, stride);
+}
+
+// sample the curve y = f(x) of a loaded expression at n evenly spaced
+// points from x0 to x1, both included, into xs and ys
+[[gnu::visibility("default")]] void lg_sample_curve(lg_handle_t id, float x0, float x1, size_t n,
+                                                   float* xs, float* ys) {
+    if (n == 0)
+        return;
+
+    float dx = n > 1 ? (x1 - x0) / (n - 1) : 0;
+    for (size_t i = 0; i < n; i++)
+        xs[i] = x0 + i * dx;
+    expr_eval_batch(get_expr(id), xs, NULL, ys, n);
+}
+
+// drop vertices of a polyline of n vertices in place, keeping each dropped
+// vertex within tol pixels of the line replacing it, where pixels are
+// px_w x px_h units. non-finite vertices break the line and are kept
+// returns the number of vertices left
+[[gnu::visibility("default")]] size_t lg_simplify_polyline(float* xs, float* ys, size_t n,
+                                                          float px_w, float px_h, float tol) {
+    if (!(px_w > 0 && px_h > 0 && tol > 0))
+        return n;
+    return polyline_simplify(xs, ys, n, px_w, px_h, tol);
+}
+
+// split a color given as 0xRRGGBBAA into channels from 0 to 1
+static void unpack_color(uint32_t color, float out[4]) {
+    for (int c = 0; c < 4; c++)
+        out[c] = ((color >> (24 - 8*c)) & 0xff) / 255.0f;
+}
+
+// sample the curve of an expression across a view, simplified and
+// in pixel coordinates, into newly allocated xs and ys
+static size_t sample_pixels(expr_t* expr, const grid_t* view, float** xs, float** ys) {
+    size_t n = view->width * RASTER_CURVE_SAMPLES + 1;
+    *xs = tmalloc(n * sizeof(float));
+    *ys = tmalloc(n * sizeof(float));
+    float dx = (view->x1 - view->x0) / (n - 1);
+    for (size_t i = 0; i < n; i++)
+        (*xs)[i] = view->x0 + i * dx;
+    expr_eval_batch(expr, *xs, NULL, *ys, n);
+
+    // far off points are pulled in, so lines towards them keep their direction
+    float px_w = (view->x1 - view->x0) / view->width, px_h = (view->y1 - view->y0) / view->height;
+    n = polyline_simplify(*xs, *ys, n, px_w, px_h, 0.1f);
+    for (size_t i = 0; i < n; i++) {
+        (*xs)[i] = ((*xs)[i] - view->x0) / px_w;
+        (*ys)[i] = fmaxf(fminf((view->y1 - (*ys)[i]) / px_h, 1e6f), -1e6f);
+    }
+    return n;
+}
+
+// render loaded expressions over [x0, x1] x [y0, y1] into a width x height
+// RGBA image with 8 bits per channel and straight alpha, ready to be
+// written out as PNG. rows are stride bytes apart, row 0 being the top.
+// layers are drawn in order over the background, and invalid ones skipped
+[[gnu::visibility("default")]] void lg_render(const lg_layer_t* layers, size_t num_layers,
+                                             float x0, float y0, float x1, float y1, int width, int height,
+                                             uint32_t background, uint8_t* rgba, size_t stride) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    grid_t view = {
+        .x0 = x0, .y0 = y0, .x1 = x1, .y1 = y1,
+        .width = width, .height = height
+    };
+    raster_layer_t* rl = tmalloc(num_layers * sizeof(raster_layer_t));
+    size_t n = 0;
+    for (size_t i = 0; i < num_layers; i++) {
+        expr_t* expr = get_expr(layers[i].id);
+        if (expr == NULL || expr->prog == NULL || layers[i].kind < LG_LAYER_CURVE || layers[i].kind > LG_LAYER_FILL)
+            continue;
+
+        raster_layer_t* l = &(rl[n++]);
+        *l = (raster_layer_t) {
+            .kind = layers[i].kind == LG_LAYER_CURVE ? RASTER_CURVE
+                  : layers[i].kind == LG_LAYER_CONTOUR ? RASTER_CONTOUR : RASTER_FILL,
+            .prog = expr->prog,
+            .width = layers[i].width
+        };
+        unpack_color(layers[i].color, l->color);
+        if (l->kind == RASTER_CURVE)
+            l->n = sample_pixels(expr, &view, (float**)&(l->xs), (float**)&(l->ys));
+    }
+
+    float bg[4];
+    unpack_color(background, bg);
+    raster_render(rl, n, &view, bg, rgba, stride);
+
+    for (size_t i = 0; i < n; i++) {
+        if (rl[i].kind == RASTER_CURVE) {
+            tfree((float*)rl[i].xs);
+            tfree((float*)rl[i].ys);
+        }
+    }
+    tfree(rl);
+}
+
+// find the zeros of a loaded expression in x, for x in [x0, x1] at a
+// fixed y. at most max_roots are written to roots in ascending order,
+// returns the number found, which may be more
+[[gnu::visibility("default")]] size_t lg_find_roots(lg_handle_t id, float x0, float x1, float y,
+                                                   float* roots, size_t max_roots) {
+    expr_t* expr = get_expr(id);
+    if (expr == NULL || expr->prog == NULL)
+        return 0;
+    return roots_find(expr->prog, NULL, y, x0, x1, roots, max_roots);
+}
+
+// find where the curves y = a(x) and y = b(x) of two loaded expressions
+// cross for x in [x0, x1]. at most max_xs x coordinates are written
+// to xs in ascending order, returns the number found
+[[gnu::visibility("default")]] size_t lg_find_intersections(lg_handle_t id_a, lg_handle_t id_b, float x0, float x1,
+                                                           float* xs, size_t max_xs) {
+    expr_t *a = get_expr(id_a), *b = get_expr(id_b);
+    if (a == NULL || a->prog == NULL || b == NULL || b->prog == NULL)
+        return 0;
+    return roots_find(a->prog, b->prog, 0, x0, x1, xs, max_xs);
+}
+
+// integrate a loaded expression over x in [x0, x1] at a fixed y,
+// to within an absolute error of about tol
+// NAN if the expression has no value
+[[gnu::visibility("default")]] float lg_integrate(lg_handle_t id, float x0, float x1, float y, float tol) {
+    expr_t* expr = get_expr(id);
+    if (expr == NULL || expr->prog == NULL)
+        return NAN;
+    return integrate(expr->prog, y, x0, x1, tol);
+}
+
+// evaluate a loaded expression in x alone through a piecewise Chebyshev
+// series within tol of it over [x0, x1], for lg_eval, lg_eval_batch and
+// lg_sample_curve. points outside [x0, x1] use the expression itself
+// returns the number of pieces, or -1 if the expression depends on
+// anything but x or needs too many pieces, in which case it's
+// evaluated as before
+[[gnu::visibility("default")]] int lg_approximate(lg_handle_t id, float x0, float x1, float tol) {
+    expr_t* expr = get_expr(id);
+    if (expr == NULL)
+        return -1;
+    return expr_approximate(expr, x0, x1, tol);
+}
+
+// set the memory budget of the tile cache in bytes
+[[gnu::visibility("default")]] void lg_set_tile_cache_size(size_t bytes) {
+    tcache_set_budget(bytes);
+}
+
+// bytes held by a loaded expression, including its cached tiles
+// 0 if the handle is invalid
+[[gnu::visibility("default")]] size_t lg_memory_usage(lg_handle_t id) {
+    expr_t* expr = get_expr(id);
+    if (expr == NULL)
+        return 0;
+    size_t draft = drafts.data[id] ? expr_size(drafts.data[id]) : 0;
+    return expr_size(expr) + draft + tcache_size(id);
+}
+
+// bytes held by the whole library, including definitions,
+// interned names and cached tiles
+[[gnu::visibility("default")]] size_t lg_memory_total(void) {
+    return tmalloc_usage();
+}
+
+// count executions and cycles per subtree of every expression evaluated
+// while enabled, at some cost to evaluation speed
+[[gnu::visibility("default")]] void lg_set_profiling(int enabled) {
+    rt_set_profiling(enabled);
+}
+
+// write the at most max_entries subtrees of a loaded expression most
+// cycles were spent in while profiling, hottest first
+// returns the number written
+[[gnu::visibility("default")]] size_t lg_profile(lg_handle_t id, lg_profile_entry_t* entries, size_t max_entries) {
+    static_assert(sizeof(lg_profile_entry_t) == sizeof(prof_entry_t));
+    expr_t* expr = get_expr(id);
+    if (expr == NULL || expr->prog == NULL)
+        return 0;
+
+    size_t n = rt_profile_report(expr->prog, (prof_entry_t*)entries, max_entries);
+
+    // spans end at the last argument of calls, so
+    // take in the parentheses closing them
+    const char* src = expr->src;
+    int src_len = expr->src_len;
+    for (size_t i = 0; i < n; i++) {
+        lg_profile_entry_t* e = &(entries[i]);
+        int open = 0;
+        for (int j = e->pos; j < e->pos + e->len; j++)
+            open += (src[j] == '(') - (src[j] == ')');
+        while (open > 0 && e->pos + e->len < src_len) {
+            open -= src[e->pos + e->len] == ')';
+            e->len++;
+        }
+    }
+    return n;
+}
+
+// clear the counts of a loaded expression
+[[gnu::visibility("default")]] void lg_profile_reset(lg_handle_t id) {
+    expr_t* expr = get_expr(id);
+    if (expr && expr->prog)
+        rt_profile_reset(expr->prog);
+}
+
+// register a function implemented by the host, callable from
+// expressions loaded afterwards. eval_batch is optional, and
+// LG_FN_PURE allows calls to be folded and shared
+// returns -1 if the name is taken or invalid, or num_args is below 1
+[[gnu::visibility("default")]] int lg_register_fn(const char* name, int num_args,
+                                                  float (*eval)(int, float[]),
+                                                  void (*eval_batch)(int, const float*[], float*, size_t),
+                                                  int flags) {
+    pthread_rwlock_wrlock(&rt_lock);
+    int res = rt_register_fn(name, num_args, eval, eval_batch, flags & LG_FN_PURE ? FN_PURE : 0);
+    pthread_rwlock_unlock(&rt_lock);
+    return res;
+}
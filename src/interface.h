@@ -1,3 +1,113 @@
 #pragma once
 
-int load_expr(const char* expr);
+#include <stddef.h>
+#include <stdint.h>
+
+// codes of problems found while compiling
+enum {
+    LG_ERR_UNEXPECTED_CHAR = 1,
+    LG_ERR_EXPECTED_OPERABLE,
+    LG_ERR_EXPECTED_OPERATOR,
+    LG_ERR_EXPECTED_CLOSING_PAREN,
+    LG_ERR_BAD_DEFINITION,
+    LG_ERR_NESTED_DEFINITION,
+    LG_ERR_REDEFINED_BUILTIN,
+    LG_ERR_BAD_PARAMETER,
+    LG_ERR_DUPLICATE_PARAMETER,
+    LG_ERR_UNRESOLVED_NAME,
+    LG_ERR_NOT_A_VARIABLE,
+    LG_ERR_WRONG_NUM_ARGS,
+    LG_ERR_CIRCULAR_DEFINITION,
+    LG_ERR_NOT_A_DEFINITION
+};
+
+// a problem found while compiling, spanning len characters
+// from position pos of the source string
+typedef struct {
+    int code;
+    int pos, len;
+    const char* msg;
+} lg_diag_t;
+
+// handle of a loaded expression, -1 if loading failed
+// handles of freed expressions may be given out again
+typedef int lg_handle_t;
+
+// status of an expression loaded by lg_load_async
+enum {
+    LG_LOAD_FAILED = -1,
+    LG_LOAD_READY,
+    LG_LOAD_PENDING
+};
+
+// a subtree of a profiled expression, spanning len characters
+// from position pos of the source string
+typedef struct {
+    int pos, len;
+
+    // times the root of the subtree was executed, cycles spent
+    // in the root alone and in the whole subtree
+    uint64_t count, self_cycles, cycles;
+} lg_profile_entry_t;
+
+// kinds of layers drawn by lg_render
+enum {
+    LG_LAYER_CURVE,
+    LG_LAYER_CONTOUR,
+    LG_LAYER_FILL
+};
+
+// a loaded expression drawn by lg_render, in a color given as 0xRRGGBBAA
+// curves are y = f(x), contours where f(x, y) = 0 and fills where
+// f(x, y) > 0, so comparisons fill where they hold. curves and contours
+// are width pixels wide
+typedef struct {
+    int kind;
+    lg_handle_t id;
+    uint32_t color;
+    float width;
+} lg_layer_t;
+
+// flags for lg_register_fn
+#define LG_FN_PURE (1 << 0)
+
+// all lg_* calls must come from the same thread, so handles and
+// diagnostics aren't locked. the done callback of lg_load_async is the
+// exception, running on a background thread without calling into the
+// library
+void lg_init(void);
+void lg_set_threads(int num_threads);
+lg_handle_t lg_load(const char* str);
+void lg_free(lg_handle_t id);
+int lg_edit(lg_handle_t id, const char* str, int pos, int old_len, int new_len);
+lg_handle_t lg_load_async(const char* str, void (*done)(lg_handle_t id, int ok, void* user), void* user);
+int lg_load_status(lg_handle_t id);
+size_t lg_load_diagnostics(lg_handle_t id, const lg_diag_t** diags);
+size_t lg_load_many(const char** srcs, size_t n, lg_handle_t* ids, const lg_diag_t** diags, size_t* num_diags);
+int lg_load_file(const char* path);
+size_t lg_diagnostics(const lg_diag_t** diags);
+void lg_set_error_output(int enabled);
+float lg_eval(lg_handle_t id, float x, float y);
+void lg_eval_batch(lg_handle_t id, const float* xs, const float* ys, float* out, size_t n);
+void lg_eval_batch_many(const lg_handle_t* ids, size_t num_ids, const float* xs, const float* ys,
+                        float** outs, size_t n);
+void lg_eval_grid(lg_handle_t id, float x0, float y0, float x1, float y1,
+                  int width, int height, float* out, size_t stride);
+void lg_eval_view(lg_handle_t id, int zoom, int64_t px, int64_t py,
+                  int width, int height, float* out, size_t stride);
+void lg_sample_curve(lg_handle_t id, float x0, float x1, size_t n, float* xs, float* ys);
+size_t lg_simplify_polyline(float* xs, float* ys, size_t n, float px_w, float px_h, float tol);
+void lg_render(const lg_layer_t* layers, size_t num_layers, float x0, float y0, float x1, float y1,
+               int width, int height, uint32_t background, uint8_t* rgba, size_t stride);
+size_t lg_find_roots(lg_handle_t id, float x0, float x1, float y, float* roots, size_t max_roots);
+size_t lg_find_intersections(lg_handle_t id_a, lg_handle_t id_b, float x0, float x1, float* xs, size_t max_xs);
+float lg_integrate(lg_handle_t id, float x0, float x1, float y, float tol);
+int lg_approximate(lg_handle_t id, float x0, float x1, float tol);
+void lg_set_tile_cache_size(size_t bytes);
+size_t lg_memory_usage(lg_handle_t id);
+void lg_set_profiling(int enabled);
+size_t lg_profile(lg_handle_t id, lg_profile_entry_t* entries, size_t max_entries);
+void lg_profile_reset(lg_handle_t id);
+size_t lg_memory_total(void);
+int lg_register_fn(const char* name, int num_args, float (*eval)(int, float[]),
+                   void (*eval_batch)(int, const float*[], float*, size_t), int flags);
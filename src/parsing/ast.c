@@ -4,6 +4,7 @@
 #include "../expression.h"
 #include "../runtime/rt.h"
 #include "error.h"
+#include "utils/intern.h"
 
 #define IS_OPERABLE(t) ((t)->type < TOKEN_OPERATOR)
 #define IS_OPERATOR(t) ((t)->type == TOKEN_OPERATOR)
@@ -60,13 +61,13 @@ static void oplist_destruct(struct oplist** ops) {
 }
 
 // convert an operable token to a node
-static ast_node_t* operable_to_node(token_t* t) {
+static pnode_t* operable_to_node(token_t* t) {
     if (t->type == TOKEN_AST_FRAGMENT) {
-        ast_node_t* ast_frag = t->data.ast_frag;
+        pnode_t* ast_frag = t->data.ast_frag;
         tfree(t);
         return ast_frag;
     } else {
-        ast_node_t* arg = tmalloc(sizeof(ast_node_t));
+        pnode_t* arg = tmalloc(sizeof(pnode_t));
         arg->children = (typeof(arg->children)) { 0 };
 
         if (t->type == TOKEN_NAME)
@@ -78,46 +79,153 @@ static ast_node_t* operable_to_node(token_t* t) {
     }
 }
 
-// print the AST as a pretty tree
-static void dbg_ast(expr_t* expr, ast_node_t* root, size_t lvl, size_t padding) {
-    static vec_struct(bool) stems;
+// start an empty AST
+void ast_init(ast_t* ast) {
+    *ast = (ast_t) {
+        .nodes = vec_new(ast_node_t),
+        .kids = vec_new(uint32_t),
+        .spans = vec_new(ast_span_t)
+    };
+}
+
+void ast_destroy(ast_t* ast) {
+    vec_destruct(&(ast->nodes));
+    vec_destruct(&(ast->kids));
+    vec_destruct(&(ast->spans));
+}
+
+// append a node whose children are already in the AST,
+// returning its index
+uint32_t ast_push(ast_t* ast, ast_node_t node, const uint32_t* children, ast_span_t span) {
+    node.children = ast->kids.len;
+    for (uint32_t i = 0; i < node.num_children; i++)
+        vec_push(&(ast->kids), children[i]);
+    vec_push(&(ast->nodes), node);
+    vec_push(&(ast->spans), span);
+    return ast->nodes.len - 1;
+}
+
+// index of the first node of a subtree, which spans
+// from there up to its root
+uint32_t ast_subtree_start(const ast_t* ast, uint32_t node) {
+    while (AST_NODE(ast, node)->num_children > 0)
+        node = AST_CHILD(ast, AST_NODE(ast, node), 0);
+    return node;
+}
+
+// copy a subtree into an empty AST
+void ast_slice(const ast_t* src, uint32_t root, ast_t* dst) {
+    uint32_t start = ast_subtree_start(src, root);
+    ast_init(dst);
+    for (uint32_t i = start; i <= root; i++) {
+        const ast_node_t* n = AST_NODE(src, i);
+        uint32_t children[n->num_children + 1];
+        for (uint32_t j = 0; j < n->num_children; j++)
+            children[j] = AST_CHILD(src, n, j) - start;
+        ast_push(dst, *n, children, src->spans.data[i]);
+    }
+}
+
+// check whether the AST is a definition
+bool ast_is_def(const ast_t* ast) {
+    const ast_node_t* root = AST_NODE(ast, AST_ROOT(ast));
+    return root->type == NODE_TYPE_OPERATOR && root->op == '=';
+}
+
+// flatten the parse tree into post-order, freeing it on the way
+static uint32_t flatten(ast_t* ast, pnode_t* p) {
+    uint32_t children[p->children.len + 1];
+    for (size_t i = 0; i < p->children.len; i++)
+        children[i] = flatten(ast, p->children.data[i]);
+
+    ast_node_t node = {
+        .type = p->type,
+        .num_children = p->children.len
+    };
+    switch (p->type) {
+        case NODE_TYPE_OPERATOR: node.op = p->token.data.operator; break;
+        case NODE_TYPE_LITERAL: node.literal = p->token.data.literal; break;
+        default: node.name_id = p->token.data.name_id; break;
+    }
+    ast_span_t span = { .pos = p->token.str_pos, .len = p->token.str_len };
+
+    if (p->children.data)
+        vec_destruct(&(p->children));
+    tfree(p);
+    return ast_push(ast, node, children, span);
+}
+
+// free a parse tree that won't be flattened
+static void pnode_free(pnode_t* p) {
+    for (size_t i = 0; i < p->children.len; i++)
+        pnode_free(p->children.data[i]);
+    if (p->children.data)
+        vec_destruct(&(p->children));
+    tfree(p);
+}
+
+// free the tokens left in an expression, along with
+// the parse trees of any fragments among them
+void parser_free_tokens(expr_t* expr) {
+    for (token_t* t = expr->tokens.first; t != NULL;) {
+        token_t* next = t->next;
+        if (t->type == TOKEN_AST_FRAGMENT)
+            pnode_free(t->data.ast_frag);
+        tfree(t);
+        t = next;
+    }
+    expr->tokens = (tokenlist_t) { 0 };
+}
+
+// print a subtree as a pretty tree
+static void dbg_ast(const ast_t* ast, uint32_t root, size_t lvl, size_t padding) {
+    static _Thread_local vec_struct(bool) stems;
     if (stems.len == lvl)
         vec_push(&stems, true);
     else
         stems.data[lvl] = true;
 
-    token_t tk = root->token;
-    switch (root->type) {
+    const ast_node_t* n = AST_NODE(ast, root);
+    switch (n->type) {
         case NODE_TYPE_OPERATOR:
-            printf("(%c)\n", tk.data.operator);
+            printf("(%s)\n", rt_ops[n->op].str);
             break;
         
         case NODE_TYPE_FUNCTION:
         case NODE_TYPE_VARIABLE:
-            printf("%s\n", hm_get(expr->name_table, tk.data.name_id)->str);
+            printf("%s\n", intern_str(n->name_id));
             break;
         
         case NODE_TYPE_LITERAL:
-            printf("%.2f\n", tk.data.literal);
+            printf("%.2f\n", n->literal);
+            break;
+
+        case NODE_TYPE_PARAM:
+            printf("$%d\n", n->param);
             break;
     }
 
-    for (size_t i = 0; i < root->children.len; i++) {
+    for (size_t i = 0; i < n->num_children; i++) {
         for (size_t j = 0; j < padding; j++)
             printf(" ");
 
         for (size_t j = 0; j < lvl; j++)
             printf(stems.data[j] ? " │" : "  ");
 
-        if (i == root->children.len - 1) {
+        if (i == n->num_children - 1u) {
             stems.data[lvl] = false;
             printf(" └─");
         } else
             printf(" ├─");
-        dbg_ast(expr, root->children.data[i], lvl + 1, padding);
+        dbg_ast(ast, AST_CHILD(ast, n, i), lvl + 1, padding);
     }
 }
 
+// print an unresolved AST
+void ast_dbg(const ast_t* ast, size_t padding) {
+    dbg_ast(ast, AST_ROOT(ast), 0, padding);
+}
+
 int parser_make_ast(expr_t* expr)
 {
     // indicates success or error
@@ -147,7 +255,7 @@ int parser_make_ast(expr_t* expr)
                     tk->data.ast_frag = operable_to_node(tk);
                     tk->type = TOKEN_AST_FRAGMENT;
                 } else if (!IS_OPERABLE(tk)) {
-                    error_at_token("expected operable value", expr, tk);
+                    error_at_token(LG_ERR_EXPECTED_OPERABLE, expr, tk);
                     ret_val = -1;
                     goto end;
                 }
@@ -161,7 +269,7 @@ int parser_make_ast(expr_t* expr)
                 } else if (tk->type == TOKEN_COMMA) {
                     vec_push(&args, tk);
                 } else {
-                    error_at_token("expected operator, ')', or ','", expr, tk);
+                    error_at_token(LG_ERR_EXPECTED_OPERATOR, expr, tk);
                     ret_val = -1;
                     goto end;
                 }
@@ -171,7 +279,7 @@ int parser_make_ast(expr_t* expr)
 
         // mismatched parens
         if (cp == NULL) {
-            error_at_token("expected closing bracket", expr, NULL);
+            error_at_token(LG_ERR_EXPECTED_CLOSING_PAREN, expr, NULL);
             ret_val = -1;
             goto end;
         }
@@ -180,24 +288,26 @@ int parser_make_ast(expr_t* expr)
         // eating up the operator and its arguments in the process
         for (struct oplist* i = ops; i != NULL; i = i->next) {
             token_t* args[2] = { i->op->prev, i->op->next };
+            token_t *prev = args[0]->prev, *next = args[1]->next;
 
             // check if its an assignment and
             // whether its LHS is a variable
             if (i->op->data.operator == '=' && args[0]->data.ast_frag->token.type != TOKEN_NAME) {
-                    error_at_token("LHS of '=' must be a variable", expr, i->op);
+                    error_at_token(LG_ERR_BAD_DEFINITION, expr, i->op);
                     ret_val = -1;
                     goto end;
             }
 
             // create node for the operator
-            ast_node_t* op = tmalloc(sizeof(ast_node_t));
-            *op = (ast_node_t) {
+            pnode_t* op = tmalloc(sizeof(pnode_t));
+            *op = (pnode_t) {
                 .type = NODE_TYPE_OPERATOR,
-                .children = vec_new(ast_node_t*)
+                .children = vec_new(pnode_t*)
             };
             op->token = *(i->op);
 
             // create nodes for arguments
+            // (this may free the argument tokens)
             for (int j = 0; j < 2; j++)
                 vec_push(&(op->children), operable_to_node(args[j]));
 
@@ -206,31 +316,30 @@ int parser_make_ast(expr_t* expr)
             *fragtoken = (token_t) {
                 .type = TOKEN_AST_FRAGMENT,
                 .data.ast_frag = op,
-                .next = args[1]->next,
-                .prev = args[0]->prev
-
+                .next = next,
+                .prev = prev
             };
 
             // remove the operator and its arguments and replace
             // it with the newly created ast fragment
-            args[0]->prev->next = fragtoken;
-            fragtoken->prev = args[0]->prev;
-            args[1]->next->prev = fragtoken;
-            fragtoken->next = args[1]->next;
+            prev->next = fragtoken;
+            next->prev = fragtoken;
+            tfree(i->op);
         }
 
         // token which will replace outer parens and its contents
         token_t* tkr = p->next;
+        token_t* name = NULL;
 
         // if there's a name just before it, that means
         // it is a function call
         if (p->prev && p->prev->type == TOKEN_NAME) {
 
             // create the function call node
-            ast_node_t* fncall = tmalloc(sizeof(ast_node_t));
-            *fncall = (ast_node_t) {
+            pnode_t* fncall = tmalloc(sizeof(pnode_t));
+            *fncall = (pnode_t) {
                 .type = NODE_TYPE_FUNCTION,
-                .children = vec_new(ast_node_t*)
+                .children = vec_new(pnode_t*)
             };
             fncall->token = *(p->prev);
 
@@ -246,7 +355,7 @@ int parser_make_ast(expr_t* expr)
 
             // we want to remove the name too,
             // not just the opening paren
-            p = p->prev;
+            name = p = p->prev;
         }
 
         // add new token in place of parens and contents
@@ -270,6 +379,8 @@ int parser_make_ast(expr_t* expr)
             tfree(a);
         } vec_iterate_end(&args);
         tfree(cp);
+        if (name)
+            tfree(name);
 
         // free operator and argument lists
         vec_destruct(&args);
@@ -277,11 +388,14 @@ int parser_make_ast(expr_t* expr)
     } vec_iterate_end(&parens);
 
     // the first token now contains the ast
-    expr->ast_root = expr->tokens.first->data.ast_frag;
+    ast_init(&(expr->ast));
+    flatten(&(expr->ast), expr->tokens.first->data.ast_frag);
+    expr->tokens.first->type = TOKEN_UNKNOWN;
+    parser_free_tokens(expr);
 
 #ifdef DEBUG
     printf("abstract syntax tree: ");
-    dbg_ast(expr, expr->ast_root, 0, 22);
+    ast_dbg(&(expr->ast), 22);
     printf("\n");
 #endif
 
@@ -1,3 +1,12 @@
 // transitional header file
+#pragma once
 
 #include "defs.h"
+
+void ast_init(ast_t* ast);
+void ast_destroy(ast_t* ast);
+uint32_t ast_push(ast_t* ast, ast_node_t node, const uint32_t* children, ast_span_t span);
+uint32_t ast_subtree_start(const ast_t* ast, uint32_t node);
+void ast_slice(const ast_t* src, uint32_t root, ast_t* dst);
+bool ast_is_def(const ast_t* ast);
+void ast_dbg(const ast_t* ast, size_t padding);
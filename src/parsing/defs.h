@@ -18,14 +18,15 @@ typedef enum {
     TOKEN_COMMA
 } tokentype_t;
 
-typedef struct ast_node_t ast_node_t;
+typedef struct pnode pnode_t;
+struct function;
 typedef struct token {
     tokentype_t type;
     union {
         float literal;
         uint8_t operator;
-        int64_t name_id;
-        ast_node_t* ast_frag;
+        int32_t name_id;
+        pnode_t* ast_frag;
     } data;
     // size and position of token in expression string
     int str_pos, str_len;
@@ -38,19 +39,62 @@ typedef struct {
     token_t *first, *last;
 } tokenlist_t;
 
-// structure of an AST node
-struct ast_node_t {
+// tokens of a source string in order, kept so it can be lexed again
+// after an edit. positions don't count the outer parentheses
+typedef vec_struct(token_t) lexed_t;
 
-    // type of node
-    enum {
-        NODE_TYPE_LITERAL,
-        NODE_TYPE_FUNCTION,
-        NODE_TYPE_OPERATOR,
-        NODE_TYPE_VARIABLE
-    } type;
+// possible node types
+typedef enum {
+    NODE_TYPE_LITERAL,
+    NODE_TYPE_FUNCTION,
+    NODE_TYPE_OPERATOR,
+    NODE_TYPE_VARIABLE,
+    NODE_TYPE_PARAM
+} nodetype_t;
 
+// node of the tree built by the parser, which
+// gets flattened into an ast_t once complete
+struct pnode {
+    nodetype_t type;
     token_t token;
 
     // children
-    vec_struct(struct ast_node_t*) children;
+    vec_struct(struct pnode*) children;
 };
+
+// structure of an AST node
+// nodes are stored in post-order in one array, and refer
+// to their children by index
+typedef struct {
+    uint8_t type;
+    uint8_t op;                     // operator, for NODE_TYPE_OPERATOR
+    uint16_t num_children;
+
+    // position of the indices of the children in the AST's kids
+    uint32_t children;
+
+    union {
+        float literal;
+        int32_t name_id;            // before resolution
+        const struct function* fn;  // function being called
+        int32_t input;              // index of plot input a variable reads
+        int32_t param;              // index of parameter in a definition
+    };
+} ast_node_t;
+
+// size and position of a node's source in expression string
+typedef struct {
+    int32_t pos, len;
+} ast_span_t;
+
+typedef struct {
+    vec_struct(ast_node_t) nodes;
+    vec_struct(uint32_t) kids;
+
+    // kept apart from the nodes, as only errors need them
+    vec_struct(ast_span_t) spans;
+} ast_t;
+
+#define AST_ROOT(ast) ((uint32_t)(ast)->nodes.len - 1)
+#define AST_NODE(ast, i) (&((ast)->nodes.data[i]))
+#define AST_CHILD(ast, node, i) ((ast)->kids.data[(node)->children + (i)])
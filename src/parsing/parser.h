@@ -2,7 +2,10 @@
 
 #include "expression.h"
 
+void parser_lex(expr_t* expr);
+void parser_relex(expr_t* expr, const expr_t* base, int pos, int old_len, int new_len);
 int parser_tokenize(expr_t* expr);
 int parser_make_ast(expr_t* expr);
+void parser_free_tokens(expr_t* expr);
 void parser_debug(expr_t* expr);
-void token_dbg(expr_t* expr, token_t* t);
+void token_dbg(token_t* t);
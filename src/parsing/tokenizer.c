@@ -4,7 +4,7 @@
 #include "tokens.h"
 #include "parser.h"
 #include "expression.h"
-#include "utils/hashmap.h"
+#include "utils/intern.h"
 #include "runtime/rt.h"
 #include "error.h"
 
@@ -20,11 +20,21 @@ static tokentype_t get_type(uint8_t c) {
         return TOKEN_NAME;
     if (c >= '0' && c <= '9')
         return TOKEN_LITERAL;
-    if (rt_ops[c].name == c)
+    if (rt_ops[c].name == c && rt_ops[c].str && rt_ops[c].str[1] == '\0')
         return TOKEN_OPERATOR;
     return ttypes[c];
 }
 
+// get the operator spelled with two characters at str, 0 if none
+static uint8_t get_long_op(const char* str, const char* end) {
+    if (end - str < 2)
+        return 0;
+    for (uint8_t op = OP_LE; op <= OP_OR; op++)
+        if (rt_ops[op].str[0] == str[0] && rt_ops[op].str[1] == str[1])
+            return op;
+    return 0;
+}
+
 static void tlist_add(tokenlist_t* l, token_t* t) {
     t->prev = l->last;
     t->next = NULL;
@@ -37,88 +47,153 @@ static void tlist_add(tokenlist_t* l, token_t* t) {
     l->last = t;
 }
 
-int parser_tokenize(expr_t* expr) {
-    char* str = (char*) expr->fn_str;
+// lex the token starting at str, returning where it ends
+// characters that can't start a token make TOKEN_UNKNOWN tokens
+static const char* lex_one(const char* str, const char* end, token_t* tk) {
+    const char* start = str;
+    tk->type = get_type(*str);
+
+    uint8_t long_op = get_long_op(str, end);
+    if (long_op)
+        tk->type = TOKEN_OPERATOR;
+
+    switch (tk->type) {
+        case TOKEN_OPERATOR: {
+            if (long_op) {
+                tk->data.operator = long_op;
+                str++;
+            } else
+                tk->data.operator = *str;
+        } break;
+
+        case TOKEN_LITERAL: {
+            float num = *(str++) - '0';
+            int dec_places = 0;
+
+            while (str < end && *str >= '0' && *str <= '9') {
+                num *= 10;
+                num += *(str++) - '0';
+            }
+            if (str < end && *str == '.') {
+                str++;
+                while (str < end && *str >= '0' && *str <= '9') {
+                    dec_places++;
+                    num += (*(str++) - '0') / pow(10, dec_places);
+                }
+            }
+            str--;
+            tk->data.literal = num;
+        } break;
+
+        case TOKEN_NAME: {
+            // calculate length of name
+            size_t len = 1;
+            while (str + len < end && get_type(str[len]) == TOKEN_NAME)
+                len++;
+            str += len - 1;
+
+            // names are shared by all expressions
+            tk->data.name_id = intern(start, len);
+        } break;
+
+        default: {
+            // just to silence compiler warnings
+        } break;
+    }
+    return str + 1;
+}
 
-    while (*str != '\0') {
+// lex from position from of the source of expr until its end, or until
+// a token would start where one of resync does, shifted by delta
+// returns the index of that token in resync, or resync->len
+static size_t lex_from(expr_t* expr, int from, const lexed_t* resync, size_t next, int delta) {
+    const char* end = expr->src + expr->src_len;
+    for (const char* str = expr->src + from; str < end;) {
         if (*str == ' ') {
             str++;
             continue;
         }
 
-        token_t* tk = tmalloc(sizeof(token_t));
-        tk->type = get_type(*str);
-        char* tk_start = str;
+        int pos = str - expr->src;
+        while (next < resync->len && resync->data[next].str_pos + delta < pos)
+            next++;
+        if (next < resync->len && resync->data[next].str_pos + delta == pos)
+            return next;
 
-        switch (tk->type) {
-            case TOKEN_OPERATOR: {
-                tk->data.operator = *str;
-            } break;
+        token_t tk = { .str_pos = pos };
+        str = lex_one(str, end, &tk);
+        tk.str_len = str - expr->src - pos;
+        vec_push(&(expr->lexed), tk);
+    }
+    return resync->len;
+}
 
-            case TOKEN_LITERAL: {
-                float num = *(str++) - '0';
-                int dec_places = 0;
+// lex the whole source of an expression
+void parser_lex(expr_t* expr) {
+    expr->lexed.len = 0;
+    lex_from(expr, 0, &(lexed_t) { 0 }, 0, 0);
+}
 
-                while (*str >= '0' && *str <= '9') {
-                    num *= 10;
-                    num += *(str++) - '0';
-                }
-                if (*str == '.') {
-                    str++;
-                    while (*str >= '0' && *str <= '9') {
-                        dec_places++;
-                        num += (*(str++) - '0') / pow(10, dec_places);
-                    }
-                }
-                str--;
-                tk->data.literal = num;
-            } break;
-
-            case TOKEN_NAME: {
-                // calculate length of name
-                size_t len = 1;
-                const char* start = str;
-                char* name;
-                while (get_type(*(++str)) == TOKEN_NAME)
-                    len++;
-
-                // allocate and fill string
-                name = tmalloc(len + 1);
-                memcpy(name, start, len);
-                name[len] = '\0';
-
-                // add to name table, if it doesn't exist
-                int64_t key = hm_find(expr->name_table, name);
-                if (key == -1)
-                    tk->data.name_id = hm_add(expr->name_table, name, 0);
-                else
-                    tk->data.name_id = key;
-                str--;
-            } break;
-
-            case TOKEN_UNKNOWN: {
-                error_at_pos("unexpected character", expr, str - expr->fn_str);
-                tfree(tk);
-                return -1;
-            } break;
-
-            default: {
-                // just to silence compiler warnings
-            } break;
-        }
+// lex the source of expr, which is the source of base with bytes [pos,
+// pos + old_len) replaced by bytes [pos, pos + new_len). only the tokens
+// around the edit are lexed again, the others are copied from base, so
+// names away from the edit aren't interned again
+void parser_relex(expr_t* expr, const expr_t* base, int pos, int old_len, int new_len) {
+    const lexed_t* old = &(base->lexed);
+    expr->lexed.len = 0;
+
+    // a token ending where the edit starts may continue into it
+    size_t first = 0;
+    while (first < old->len && old->data[first].str_pos + old->data[first].str_len < pos)
+        vec_push(&(expr->lexed), old->data[first++]);
+    int from = first < old->len && old->data[first].str_pos < pos ? old->data[first].str_pos : pos;
+
+    // tokens starting after the edit are only shifted, from the
+    // first one the new tokens line up with
+    size_t after = first;
+    while (after < old->len && old->data[after].str_pos < pos + old_len)
+        after++;
+    int delta = new_len - old_len;
+    size_t next = lex_from(expr, from, old, after, delta);
+    for (; next < old->len; next++) {
+        token_t tk = old->data[next];
+        tk.str_pos += delta;
+        vec_push(&(expr->lexed), tk);
+    }
+}
 
-        // calculate position and length of token in string
-        tk->str_pos = (size_t)(tk_start - expr->fn_str);
-        tk->str_len = (size_t)(str - tk_start) + 1;
+// add one of the parentheses the expression is read as wrapped in
+static void add_paren(expr_t* expr, tokentype_t type, int pos) {
+    token_t* tk = tmalloc(sizeof(token_t));
+    tk->type = type;
+    tk->str_pos = pos;
+    tk->str_len = 1;
+    tlist_add(&(expr->tokens), tk);
+}
 
+// make the token list the parser works on from the lexed tokens
+// the source is read as if it were wrapped in parentheses, making it a
+// single group for the parser, so positions are one past the source's
+int parser_tokenize(expr_t* expr) {
+    add_paren(expr, TOKEN_OPENING_PAREN, 0);
+    for (size_t i = 0; i < expr->lexed.len; i++) {
+        const token_t* lexed = &(expr->lexed.data[i]);
+        if (lexed->type == TOKEN_UNKNOWN) {
+            error_at_pos(LG_ERR_UNEXPECTED_CHAR, expr, lexed->str_pos + 1);
+            return -1;
+        }
+
+        token_t* tk = tmalloc(sizeof(token_t));
+        *tk = *lexed;
+        tk->str_pos++;
         tlist_add(&(expr->tokens), tk);
-        str++;
     }
+    add_paren(expr, TOKEN_CLOSING_PAREN, expr->src_len + 1);
 
 #ifdef DEBUG
     printf("tokenised expression: ");
     for (token_t* t = expr->tokens.first; t != NULL; t = t->next) {
-        token_dbg(expr, t);
+        token_dbg(t);
     }
     printf("\n");
 #endif
@@ -126,7 +201,7 @@ int parser_tokenize(expr_t* expr) {
     return 0;
 }
 
-void token_dbg(expr_t* expr, token_t* t) {
+void token_dbg(token_t* t) {
     static char* types[] = {
         [TOKEN_OPENING_PAREN] = "(",
         [TOKEN_CLOSING_PAREN] = ")",
@@ -135,11 +210,11 @@ void token_dbg(expr_t* expr, token_t* t) {
 
     switch (t->type) {
         case TOKEN_NAME:
-            printf("%s", hm_get(expr->name_table, t->data.name_id)->str);
+            printf("%s", intern_str(t->data.name_id));
             break;
 
         case TOKEN_OPERATOR:
-            printf(" %c ", t->data.operator);
+            printf(" %s ", rt_ops[t->data.operator].str);
             break;
             
         case TOKEN_LITERAL:
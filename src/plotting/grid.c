@@ -0,0 +1,66 @@
+#include "grid.h"
+#include "runtime/rt.h"
+#include "utils/pool.h"
+
+struct grid_job {
+    const ir_prog_t* prog;
+    const grid_t* grid;
+    float* out;
+    size_t stride;
+    size_t tiles_x;
+};
+
+// evaluate one tile, all of whose inputs and outputs fit in cache
+static void eval_tile(const struct grid_job* job, size_t tile) {
+    const grid_t* g = job->grid;
+    size_t tx = (tile % job->tiles_x) * GRID_TILE_SIZE,
+           ty = (tile / job->tiles_x) * GRID_TILE_SIZE;
+    size_t w = g->width - tx < GRID_TILE_SIZE ? g->width - tx : GRID_TILE_SIZE,
+           h = g->height - ty < GRID_TILE_SIZE ? g->height - ty : GRID_TILE_SIZE;
+
+    float dx = (g->x1 - g->x0) / g->width,
+          dy = (g->y1 - g->y0) / g->height;
+
+    // rows of the tile are laid out one after another, so
+    // batches run along rows
+    float xs[GRID_TILE_SIZE * GRID_TILE_SIZE],
+          ys[GRID_TILE_SIZE * GRID_TILE_SIZE],
+          vals[GRID_TILE_SIZE * GRID_TILE_SIZE];
+    for (size_t i = 0; i < w; i++)
+        xs[i] = g->x0 + (tx + i + 0.5f) * dx;
+    for (size_t j = 0; j < h; j++) {
+        float y = g->y1 - (ty + j + 0.5f) * dy;
+        for (size_t i = 0; i < w; i++) {
+            xs[j*w + i] = xs[i];
+            ys[j*w + i] = y;
+        }
+    }
+
+    const float* inputs[RT_NUM_INPUTS] = { xs, ys };
+    rt_eval_batch(job->prog, inputs, vals, w * h);
+
+    for (size_t j = 0; j < h; j++) {
+        float* row = job->out + (ty + j) * job->stride + tx;
+        for (size_t i = 0; i < w; i++)
+            row[i] = vals[j*w + i];
+    }
+}
+
+static void eval_tiles(void* ctx, size_t begin, size_t end) {
+    for (size_t t = begin; t < end; t++)
+        eval_tile(ctx, t);
+}
+
+// evaluate a program over a grid into out, whose rows are stride floats apart
+// tiles are spread over the thread pool
+void grid_eval(const ir_prog_t* prog, const grid_t* grid, float* out, size_t stride) {
+    struct grid_job job = {
+        .prog = prog,
+        .grid = grid,
+        .out = out,
+        .stride = stride,
+        .tiles_x = (grid->width + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE
+    };
+    size_t tiles_y = (grid->height + GRID_TILE_SIZE - 1) / GRID_TILE_SIZE;
+    pool_for(job.tiles_x * tiles_y, 1, &eval_tiles, &job);
+}
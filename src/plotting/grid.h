@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include "runtime/ir.h"
+
+// size of the square tiles grids are evaluated in
+#define GRID_TILE_SIZE 64
+
+// a rectangular area sampled at the centers of width x height cells
+// row 0 is at the top (y1), column 0 at the left (x0)
+typedef struct {
+    float x0, y0, x1, y1;
+    size_t width, height;
+} grid_t;
+
+void grid_eval(const ir_prog_t* prog, const grid_t* grid, float* out, size_t stride);
@@ -0,0 +1,133 @@
+#include <math.h>
+#include <float.h>
+#include <stdbool.h>
+#include "integrate.h"
+#include "runtime/rt.h"
+#include "utils/pool.h"
+#include "utils/tmalloc.h"
+#include "utils/vector.h"
+
+// nodes of the 15 point Kronrod rule on [-1, 1], the odd
+// ones being the nodes of the 7 point Gauss rule
+static const double xgk[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.0
+};
+static const double wgk[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+static const double wg[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+};
+
+#define GK_NODES 15
+
+// a subinterval and its estimates
+struct interval {
+    double a, b;
+    double val, err;
+};
+
+typedef vec_struct(struct interval) interval_list_t;
+
+struct gk_job {
+    const ir_prog_t* prog;
+    float y;
+    struct interval* intervals;
+};
+
+// apply both rules to the intervals begin..end, evaluating
+// all of their nodes in one batch
+static void gk_range(void* ctx, size_t begin, size_t end) {
+    struct gk_job* job = ctx;
+    size_t n = (end - begin) * GK_NODES;
+    float* buf = tmalloc(3 * n * sizeof(float));
+    float *xs = buf, *ys = buf + n, *fs = buf + 2*n;
+
+    for (size_t i = begin; i < end; i++) {
+        const struct interval* iv = &(job->intervals[i]);
+        double c = 0.5 * (iv->a + iv->b), h = 0.5 * (iv->b - iv->a);
+        float* x = xs + (i - begin) * GK_NODES;
+        for (int j = 0; j < 8; j++) {
+            x[j] = c - h * xgk[j];
+            x[GK_NODES - 1 - j] = c + h * xgk[j];
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        ys[i] = job->y;
+
+    const float* inputs[RT_NUM_INPUTS] = { xs, ys };
+    rt_eval_batch(job->prog, inputs, fs, n);
+
+    for (size_t i = begin; i < end; i++) {
+        struct interval* iv = &(job->intervals[i]);
+        const float* f = fs + (i - begin) * GK_NODES;
+        double k = wgk[7] * f[7], g = wg[3] * f[7];
+        for (int j = 0; j < 7; j++) {
+            double pair = (double)f[j] + f[GK_NODES - 1 - j];
+            k += wgk[j] * pair;
+            if (j % 2 == 1)
+                g += wg[j / 2] * pair;
+        }
+
+        double h = 0.5 * (iv->b - iv->a);
+        iv->val = k * h;
+        iv->err = fabs((k - g) * h);
+    }
+    tfree(buf);
+}
+
+// integrate a program over x in [x0, x1] at a fixed y, to within about
+// tol. every round applies the 15 point Gauss-Kronrod rule to all
+// subintervals that still need refining, spread over the thread pool,
+// and halves those whose error is above their share of tol
+double integrate(const ir_prog_t* prog, float y, float x0, float x1, float tol) {
+    if (x0 == x1)
+        return 0;
+
+    interval_list_t active = vec_new(struct interval);
+    interval_list_t next = vec_new(struct interval);
+    double width = (double)x1 - x0, dx = width / INTEGRATE_INITIAL;
+    for (int i = 0; i < INTEGRATE_INITIAL; i++) {
+        struct interval iv = { .a = x0 + i * dx, .b = x0 + (i + 1) * dx };
+        vec_push(&active, iv);
+    }
+
+    double sum = 0;
+    while (active.len > 0) {
+        struct gk_job job = { .prog = prog, .y = y, .intervals = active.data };
+        pool_for(active.len, INTEGRATE_GRAIN, &gk_range, &job);
+
+        bool give_up = active.len * 2 > INTEGRATE_MAX_ACTIVE;
+        next.len = 0;
+        for (size_t i = 0; i < active.len; i++) {
+            struct interval* iv = &(active.data[i]);
+
+            // values are floats, so errors can't go below their precision
+            double share = tol * fabs((iv->b - iv->a) / width);
+            double floor = 50 * FLT_EPSILON * fabs(iv->val);
+            if (iv->err <= share || iv->err <= floor || give_up) {
+                sum += iv->val;
+                continue;
+            }
+
+            double mid = 0.5 * (iv->a + iv->b);
+            vec_push(&next, ((struct interval) { .a = iv->a, .b = mid }));
+            vec_push(&next, ((struct interval) { .a = mid, .b = iv->b }));
+        }
+
+        interval_list_t tmp = active;
+        active = next;
+        next = tmp;
+    }
+
+    vec_destruct(&active);
+    vec_destruct(&next);
+    return sum;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "runtime/ir.h"
+
+// subintervals the interval starts out split into
+#define INTEGRATE_INITIAL 16
+
+// subintervals evaluated by each task
+#define INTEGRATE_GRAIN 16
+
+// how many subintervals can be refined at once before giving up
+#define INTEGRATE_MAX_ACTIVE (1 << 14)
+
+double integrate(const ir_prog_t* prog, float y, float x0, float x1, float tol);
@@ -0,0 +1,121 @@
+/*
+    Simplification of sampled polylines
+    vertices are dropped in one pass, keeping every dropped vertex
+    within a tolerance of the line that replaces it. directions from
+    the last kept vertex that stay within the tolerance of every
+    vertex since form a wedge, which narrows as vertices are passed,
+    and a vertex is kept once the next one falls outside of it. the
+    wedge says nothing about how far out the line goes, so a vertex is
+    also kept once the next one comes back towards the anchor
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include "polyline.h"
+
+struct writer {
+    float *xs, *ys;
+    size_t len;
+};
+
+static void put(struct writer* w, float x, float y) {
+    w->xs[w->len] = x;
+    w->ys[w->len] = y;
+    w->len++;
+}
+
+// simplify the polyline of n vertices (xs[i], ys[i]) in place, returning
+// the number of vertices kept. distances are measured in pixels of
+// px_w x px_h units, and no dropped vertex is further than tol pixels
+// from the line through the vertices kept around it. non-finite vertices
+// split the polyline, and are kept along with the vertices around them
+size_t polyline_simplify(float* xs, float* ys, size_t n, float px_w, float px_h, float tol) {
+    if (n <= 2)
+        return n;
+
+    // vertices are only ever written at or before where they are read
+    struct writer w = { .xs = xs, .ys = ys, .len = 0 };
+
+    // last kept vertex, in pixels
+    float ax = 0, ay = 0;
+    bool anchored = false;
+
+    // directions allowed from the anchor, as angles from the
+    // direction towards the first vertex further than tol
+    float ref_x = 0, ref_y = 0, lo = 0, hi = 0;
+    bool have_ref = false;
+
+    // furthest distance from the anchor passed since it was kept
+    float far = 0;
+
+    // whether the previous vertex has been kept
+    bool prev_kept = false;
+
+    for (size_t i = 0; i < n; i++) {
+        float x = xs[i], y = ys[i];
+        if (!isfinite(x) || !isfinite(y)) {
+            if (!prev_kept && i > 0)
+                put(&w, xs[i - 1], ys[i - 1]);
+            put(&w, x, y);
+            anchored = false;
+            prev_kept = true;
+            continue;
+        }
+
+        float px = x / px_w, py = y / px_h;
+        if (!anchored) {
+            put(&w, x, y);
+            ax = px;
+            ay = py;
+            anchored = true;
+            have_ref = false;
+            far = 0;
+            prev_kept = true;
+            continue;
+        }
+
+        float dx = px - ax, dy = py - ay;
+        float dist = sqrtf(dx*dx + dy*dy);
+
+        // close enough to the anchor for any direction, unless the
+        // line has already been further out
+        if (dist <= tol && far == 0) {
+            prev_kept = false;
+            continue;
+        }
+
+        if (!have_ref) {
+            ref_x = dx / dist;
+            ref_y = dy / dist;
+            lo = -INFINITY;
+            hi = INFINITY;
+            have_ref = true;
+        }
+        float angle = atan2f(ref_x*dy - ref_y*dx, ref_x*dx + ref_y*dy);
+
+        if (dist < far || angle < lo || angle > hi) {
+            // the line to this vertex would stray too far from one
+            // passed since the anchor, or stop short of it, so the
+            // previous one is kept and becomes the anchor this vertex
+            // is looked at from
+            put(&w, xs[i - 1], ys[i - 1]);
+            ax = xs[i - 1] / px_w;
+            ay = ys[i - 1] / px_h;
+            have_ref = false;
+            far = 0;
+            prev_kept = true;
+            i--;
+            continue;
+        }
+
+        float half = asinf(tol / dist);
+        lo = fmaxf(lo, angle - half);
+        hi = fminf(hi, angle + half);
+        far = dist;
+        prev_kept = false;
+    }
+
+    if (!prev_kept)
+        put(&w, xs[n - 1], ys[n - 1]);
+    return w.len;
+}
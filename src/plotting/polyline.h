@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stddef.h>
+
+size_t polyline_simplify(float* xs, float* ys, size_t n, float px_w, float px_h, float tol);
@@ -0,0 +1,198 @@
+/*
+    Anti-aliased rendering into RGBA images
+    the image is split into tiles rendered in parallel, each drawing
+    every layer into a coverage mask and blending it over the tile.
+    curves are covered by distance to their segments, contours by the
+    distance to the zero of the program estimated from its gradient,
+    and fills by the share of samples inside them
+*/
+
+#include <math.h>
+#include <string.h>
+#include "raster.h"
+#include "runtime/rt.h"
+#include "utils/pool.h"
+#include "utils/tmalloc.h"
+
+#define TILE_PIXELS (RASTER_TILE_SIZE * RASTER_TILE_SIZE)
+
+// contours are evaluated one pixel past the tile on every side
+#define MARGIN_SIZE (RASTER_TILE_SIZE + 2)
+
+struct raster_job {
+    const raster_layer_t* layers;
+    size_t num_layers;
+    const grid_t* view;
+    const float* background;
+    uint8_t* out;
+    size_t stride;
+    size_t tiles_x;
+};
+
+// a tile being rendered, w x h pixels from pixel (tx, ty)
+struct tile {
+    size_t tx, ty, w, h;
+
+    // premultiplied colors, and coverage of the current layer
+    float rgba[TILE_PIXELS * 4];
+    float cover[TILE_PIXELS];
+
+    float xs[MARGIN_SIZE * MARGIN_SIZE];
+    float ys[MARGIN_SIZE * MARGIN_SIZE];
+    float vals[MARGIN_SIZE * MARGIN_SIZE];
+};
+
+static float clamp01(float v) {
+    return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+// coverage of a pixel at distance d from the middle of a line
+// lines thinner than a pixel are drawn one pixel wide, but fainter
+static float line_cover(float d, float width) {
+    float half = width < 1 ? 0.5f : width / 2;
+    return clamp01(half + 0.5f - d) * (width < 1 ? width : 1);
+}
+
+static void cover_curve(struct tile* t, const raster_layer_t* l) {
+    float r = (l->width < 1 ? 1 : l->width) / 2 + 1;
+    for (size_t k = 0; k + 1 < l->n; k++) {
+        float ax = l->xs[k], ay = l->ys[k], bx = l->xs[k + 1], by = l->ys[k + 1];
+        if (!isfinite(ax) || !isfinite(ay) || !isfinite(bx) || !isfinite(by))
+            continue;
+
+        // pixels of the tile near the segment
+        float x0 = fminf(ax, bx) - r - t->tx, x1 = fmaxf(ax, bx) + r - t->tx,
+              y0 = fminf(ay, by) - r - t->ty, y1 = fmaxf(ay, by) + r - t->ty;
+        if (x1 < 0 || y1 < 0 || x0 > t->w || y0 > t->h)
+            continue;
+        size_t i0 = x0 < 0 ? 0 : x0, i1 = x1 > t->w ? t->w : x1,
+               j0 = y0 < 0 ? 0 : y0, j1 = y1 > t->h ? t->h : y1;
+
+        float dx = bx - ax, dy = by - ay, len2 = dx*dx + dy*dy;
+        for (size_t j = j0; j < j1; j++) {
+            for (size_t i = i0; i < i1; i++) {
+                float px = t->tx + i + 0.5f - ax, py = t->ty + j + 0.5f - ay;
+                float s = len2 > 0 ? clamp01((px*dx + py*dy) / len2) : 0;
+                float ex = px - s*dx, ey = py - s*dy;
+                float c = line_cover(sqrtf(ex*ex + ey*ey), l->width);
+                float* cover = &(t->cover[j*t->w + i]);
+                if (c > *cover)
+                    *cover = c;
+            }
+        }
+    }
+}
+
+// evaluate a program at the w x h points of a grid of pixels from
+// pixel (px, py), offset by (ox, oy) pixels from their centers
+static void eval_pixels(struct tile* t, const ir_prog_t* prog, const grid_t* view,
+                        float px, float py, size_t w, size_t h, float ox, float oy) {
+    float dx = (view->x1 - view->x0) / view->width,
+          dy = (view->y1 - view->y0) / view->height;
+    for (size_t j = 0; j < h; j++) {
+        float y = view->y1 - (py + j + 0.5f + oy) * dy;
+        for (size_t i = 0; i < w; i++) {
+            t->xs[j*w + i] = view->x0 + (px + i + 0.5f + ox) * dx;
+            t->ys[j*w + i] = y;
+        }
+    }
+    const float* inputs[RT_NUM_INPUTS] = { t->xs, t->ys };
+    rt_eval_batch(prog, inputs, t->vals, w * h);
+}
+
+static void cover_contour(struct tile* t, const raster_layer_t* l, const grid_t* view) {
+    size_t mw = t->w + 2;
+    eval_pixels(t, l->prog, view, (float)t->tx - 1, (float)t->ty - 1, mw, t->h + 2, 0, 0);
+
+    // distance to the zero, from the value and central differences
+    for (size_t j = 0; j < t->h; j++) {
+        for (size_t i = 0; i < t->w; i++) {
+            const float* v = &(t->vals[(j + 1)*mw + i + 1]);
+            float gx = (v[1] - v[-1]) / 2, gy = (v[mw] - v[-(ptrdiff_t)mw]) / 2;
+            float d = fabsf(v[0]) / sqrtf(gx*gx + gy*gy);
+            t->cover[j*t->w + i] = v[0] == 0 ? line_cover(0, l->width)
+                                 : isfinite(d) ? line_cover(d, l->width) : 0;
+        }
+    }
+}
+
+static void cover_fill(struct tile* t, const raster_layer_t* l, const grid_t* view) {
+    const int n = RASTER_FILL_SAMPLES;
+    for (int sy = 0; sy < n; sy++) {
+        for (int sx = 0; sx < n; sx++) {
+            float ox = (sx + 0.5f) / n - 0.5f, oy = (sy + 0.5f) / n - 0.5f;
+            eval_pixels(t, l->prog, view, t->tx, t->ty, t->w, t->h, ox, oy);
+            for (size_t i = 0; i < t->w * t->h; i++)
+                t->cover[i] += (t->vals[i] > 0) * (1.0f / (n * n));
+        }
+    }
+}
+
+static void render_tile(const struct raster_job* job, struct tile* t, size_t tile) {
+    const grid_t* view = job->view;
+    t->tx = (tile % job->tiles_x) * RASTER_TILE_SIZE;
+    t->ty = (tile / job->tiles_x) * RASTER_TILE_SIZE;
+    t->w = view->width - t->tx < RASTER_TILE_SIZE ? view->width - t->tx : RASTER_TILE_SIZE;
+    t->h = view->height - t->ty < RASTER_TILE_SIZE ? view->height - t->ty : RASTER_TILE_SIZE;
+    size_t n = t->w * t->h;
+
+    const float* bg = job->background;
+    for (size_t i = 0; i < n; i++)
+        for (int c = 0; c < 4; c++)
+            t->rgba[4*i + c] = c < 3 ? bg[c] * bg[3] : bg[3];
+
+    for (size_t k = 0; k < job->num_layers; k++) {
+        const raster_layer_t* l = &(job->layers[k]);
+        memset(t->cover, 0, n * sizeof(float));
+        switch (l->kind) {
+            case RASTER_CURVE: cover_curve(t, l); break;
+            case RASTER_CONTOUR: cover_contour(t, l, view); break;
+            case RASTER_FILL: cover_fill(t, l, view); break;
+        }
+
+        // blend the layer over what's below it
+        for (size_t i = 0; i < n; i++) {
+            float a = t->cover[i] * l->color[3];
+            for (int c = 0; c < 4; c++)
+                t->rgba[4*i + c] = (c < 3 ? l->color[c] : 1) * a + t->rgba[4*i + c] * (1 - a);
+        }
+    }
+
+    // images are stored with straight alpha
+    for (size_t j = 0; j < t->h; j++) {
+        uint8_t* row = job->out + (t->ty + j) * job->stride + 4 * t->tx;
+        for (size_t i = 0; i < t->w; i++) {
+            const float* p = &(t->rgba[4 * (j*t->w + i)]);
+            float a = p[3];
+            for (int c = 0; c < 4; c++) {
+                float v = c < 3 ? (a > 0 ? p[c] / a : 0) : a;
+                row[4*i + c] = (uint8_t)(clamp01(v) * 255 + 0.5f);
+            }
+        }
+    }
+}
+
+static void render_tiles(void* ctx, size_t begin, size_t end) {
+    struct tile* t = tmalloc(sizeof(struct tile));
+    for (size_t i = begin; i < end; i++)
+        render_tile(ctx, t, i);
+    tfree(t);
+}
+
+// render layers over a background into an RGBA image of the view's
+// width x height pixels, whose rows are stride bytes apart, row 0 being
+// the top. tiles are spread over the thread pool
+void raster_render(const raster_layer_t* layers, size_t num_layers, const grid_t* view,
+                   const float background[4], uint8_t* out, size_t stride) {
+    struct raster_job job = {
+        .layers = layers,
+        .num_layers = num_layers,
+        .view = view,
+        .background = background,
+        .out = out,
+        .stride = stride,
+        .tiles_x = (view->width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE
+    };
+    size_t tiles_y = (view->height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    pool_for(job.tiles_x * tiles_y, 1, &render_tiles, &job);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "runtime/ir.h"
+#include "plotting/grid.h"
+
+// size of the square tiles images are rendered in
+#define RASTER_TILE_SIZE 64
+
+// samples per pixel along each axis when covering fills
+#define RASTER_FILL_SAMPLES 3
+
+// samples per pixel column taken of curves
+#define RASTER_CURVE_SAMPLES 2
+
+typedef enum {
+    RASTER_CURVE,
+    RASTER_CONTOUR,
+    RASTER_FILL
+} raster_kind_t;
+
+// something drawn into an image, in a straight RGBA color
+typedef struct {
+    raster_kind_t kind;
+
+    // curves are polylines of n vertices in pixel coordinates,
+    // non-finite vertices breaking them
+    const float *xs, *ys;
+    size_t n;
+
+    // contours are where the program is 0, fills where it's positive
+    const ir_prog_t* prog;
+
+    float color[4];
+
+    // width of curves and contours in pixels
+    float width;
+} raster_layer_t;
+
+void raster_render(const raster_layer_t* layers, size_t num_layers, const grid_t* view,
+                   const float background[4], uint8_t* out, size_t stride);
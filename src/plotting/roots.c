@@ -0,0 +1,158 @@
+#include <math.h>
+#include <float.h>
+#include "roots.h"
+#include "runtime/rt.h"
+#include "utils/pool.h"
+#include "utils/tmalloc.h"
+
+// finds the zeros of a(x, y) - b(x, y) in x
+struct roots_job {
+    const ir_prog_t *a, *b;
+    float y;
+    double x0, dx;
+
+    // root found in each segment, NAN if none
+    float* found;
+};
+
+static double sample(const struct roots_job* job, size_t i) {
+    return job->x0 + job->dx * i;
+}
+
+static double f(const struct roots_job* job, double x) {
+    float inputs[RT_NUM_INPUTS] = { x, job->y };
+    float v = rt_eval(job->a, inputs);
+    if (job->b)
+        v -= rt_eval(job->b, inputs);
+    return v;
+}
+
+// refine a root bracketed by a and b with Brent's method, which
+// falls back to bisection whenever interpolation doesn't
+// shrink the bracket fast enough
+static double brent(const struct roots_job* job, double a, double b, double fa, double fb) {
+    double c = b, fc = fb, d = b - a, e = d;
+    for (int iter = 0; iter < ROOTS_MAX_ITER; iter++) {
+        // keep the root between b and c, with b the best guess
+        if ((fb > 0) == (fc > 0)) {
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (fabs(fc) < fabs(fb)) {
+            a = b; b = c; c = a;
+            fa = fb; fb = fc; fc = fa;
+        }
+
+        // values are floats, so there's no point going further
+        double tol = FLT_EPSILON * fabs(b) + FLT_MIN;
+        double m = 0.5 * (c - b);
+        if (fabs(m) <= tol || fb == 0)
+            return b;
+
+        if (fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+            double s = fb / fa, p, q;
+            if (a == c) {
+                // secant
+                p = 2 * m * s;
+                q = 1 - s;
+            } else {
+                // inverse quadratic interpolation
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2 * m * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0)
+                q = -q;
+            else
+                p = -p;
+
+            if (2 * p < fmin(3 * m * q - fabs(tol * q), fabs(e * q))) {
+                e = d;
+                d = p / q;
+            } else
+                d = e = m;
+        } else
+            d = e = m;
+
+        a = b;
+        fa = fb;
+        b += fabs(d) > tol ? d : (m > 0 ? tol : -tol);
+        fb = f(job, b);
+    }
+    return b;
+}
+
+// screen the segments begin..end with one batch evaluation, and
+// refine the ones whose ends have different signs
+static void find_range(void* ctx, size_t begin, size_t end) {
+    struct roots_job* job = ctx;
+    size_t n = end - begin + 1;
+
+    float* buf = tmalloc(4 * n * sizeof(float));
+    float *xs = buf, *ys = buf + n, *va = buf + 2*n, *vb = buf + 3*n;
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = sample(job, begin + i);
+        ys[i] = job->y;
+    }
+    const float* inputs[RT_NUM_INPUTS] = { xs, ys };
+    rt_eval_batch(job->a, inputs, va, n);
+    if (job->b) {
+        rt_eval_batch(job->b, inputs, vb, n);
+        for (size_t i = 0; i < n; i++)
+            va[i] -= vb[i];
+    }
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        double fa = va[i], fb = va[i + 1];
+        if (fa == 0) {
+            job->found[begin + i] = xs[i];
+        } else if (fa * fb < 0 && isfinite(fa) && isfinite(fb)) {
+            double r = brent(job, xs[i], xs[i + 1], fa, fb);
+
+            // a sign change across a pole isn't a root
+            if (fabs(f(job, r)) <= fmax(fabs(fa), fabs(fb)))
+                job->found[begin + i] = r;
+        }
+    }
+    tfree(buf);
+}
+
+// find the zeros of a(x, y) - b(x, y) for x in [x0, x1], or those of
+// a if b is NULL. roots are bracketed by sign changes between samples
+// spread over the thread pool, so double roots may be missed.
+// writes at most max roots in ascending order, returning how many were found
+size_t roots_find(const ir_prog_t* a, const ir_prog_t* b, float y,
+                  float x0, float x1, float* out, size_t max) {
+    if (!(x1 > x0))
+        return 0;
+
+    float* found = tmalloc(ROOTS_SAMPLES * sizeof(float));
+    for (size_t i = 0; i < ROOTS_SAMPLES; i++)
+        found[i] = NAN;
+
+    struct roots_job job = {
+        .a = a, .b = b,
+        .y = y,
+        .x0 = x0,
+        .dx = ((double)x1 - x0) / (ROOTS_SAMPLES - 1),
+        .found = found
+    };
+    pool_for(ROOTS_SAMPLES - 1, ROOTS_GRAIN, &find_range, &job);
+
+    // the last sample isn't the start of any segment
+    if (f(&job, x1) == 0)
+        found[ROOTS_SAMPLES - 1] = x1;
+
+    size_t count = 0;
+    for (size_t i = 0; i < ROOTS_SAMPLES; i++) {
+        if (isnan(found[i]))
+            continue;
+        if (count < max)
+            out[count] = found[i];
+        count++;
+    }
+    tfree(found);
+    return count;
+}
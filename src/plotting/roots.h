@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include "runtime/ir.h"
+
+// number of points the interval is sampled at to bracket roots
+#define ROOTS_SAMPLES 8193
+
+// segments between samples handled by each task
+#define ROOTS_GRAIN 1024
+
+// iterations after which refining a bracket gives up
+#define ROOTS_MAX_ITER 100
+
+size_t roots_find(const ir_prog_t* a, const ir_prog_t* b, float y,
+                  float x0, float x1, float* out, size_t max);
@@ -0,0 +1,251 @@
+/*
+    Cache of evaluated grid tiles, for views that pan and zoom
+    tiles are aligned to a global pixel grid for each zoom level,
+    so a view that pans by whole pixels reuses every tile still
+    in sight, and only newly exposed tiles get evaluated
+*/
+
+#include <math.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "tcache.h"
+#include "grid.h"
+#include "utils/pool.h"
+#include "utils/tmalloc.h"
+
+#define TILE_PIXELS (GRID_TILE_SIZE * GRID_TILE_SIZE)
+#define TILE_BYTES (TILE_PIXELS * sizeof(float))
+
+typedef struct tile {
+    // expression id, zoom and tile coordinates
+    int64_t id, tx, ty;
+    int zoom;
+
+    // compilation of the expression the tile was evaluated with
+    uint64_t generation;
+    float* vals;
+
+    // hash chain, and least recently used list
+    struct tile *next, *lru_prev, *lru_next;
+} tile_t;
+
+static struct {
+    pthread_mutex_t lock;
+    size_t budget, num_tiles;
+
+    tile_t** buckets;
+    size_t num_buckets;
+
+    // most recently used first
+    tile_t *lru_first, *lru_last;
+} cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .budget = TCACHE_BUDGET_DEFAULT
+};
+
+static size_t tile_hash(int64_t id, int zoom, int64_t tx, int64_t ty) {
+    uint64_t h = (uint64_t)id * 0x9e3779b97f4a7c15u;
+    h = (h ^ (uint64_t)zoom) * 0xff51afd7ed558ccdu;
+    h = (h ^ (uint64_t)tx) * 0xc4ceb9fe1a85ec53u;
+    h = (h ^ (uint64_t)ty) * 0x9e3779b97f4a7c15u;
+    return (h >> 17) % cache.num_buckets;
+}
+
+static void lru_unlink(tile_t* t) {
+    if (t->lru_prev) t->lru_prev->lru_next = t->lru_next;
+    else cache.lru_first = t->lru_next;
+    if (t->lru_next) t->lru_next->lru_prev = t->lru_prev;
+    else cache.lru_last = t->lru_prev;
+}
+
+static void lru_push(tile_t* t) {
+    t->lru_prev = NULL;
+    t->lru_next = cache.lru_first;
+    if (cache.lru_first) cache.lru_first->lru_prev = t;
+    else cache.lru_last = t;
+    cache.lru_first = t;
+}
+
+static void tile_remove(tile_t* t) {
+    tile_t** p = &(cache.buckets[tile_hash(t->id, t->zoom, t->tx, t->ty)]);
+    while (*p != t)
+        p = &((*p)->next);
+    *p = t->next;
+    lru_unlink(t);
+    tfree(t->vals);
+    tfree(t);
+    cache.num_tiles--;
+}
+
+static tile_t* tile_find(int64_t id, int zoom, int64_t tx, int64_t ty) {
+    if (cache.buckets == NULL)
+        return NULL;
+    for (tile_t* t = cache.buckets[tile_hash(id, zoom, tx, ty)]; t != NULL; t = t->next)
+        if (t->id == id && t->zoom == zoom && t->tx == tx && t->ty == ty)
+            return t;
+    return NULL;
+}
+
+// make room for one more tile, returns false if the budget is too small
+static bool make_room(void) {
+    size_t max_tiles = cache.budget / TILE_BYTES;
+    while (cache.num_tiles > 0 && cache.num_tiles >= max_tiles)
+        tile_remove(cache.lru_last);
+    return max_tiles > 0;
+}
+
+// add a tile to the cache, which takes ownership of vals
+static void tile_insert(int64_t id, uint64_t generation, int zoom, int64_t tx, int64_t ty, float* vals) {
+    if (cache.buckets == NULL) {
+        cache.num_buckets = 1021;
+        cache.buckets = tmalloc(cache.num_buckets * sizeof(tile_t*));
+        memset(cache.buckets, 0, cache.num_buckets * sizeof(tile_t*));
+    }
+
+    tile_t* t = tile_find(id, zoom, tx, ty);
+    if (t)
+        tile_remove(t);
+    if (!make_room()) {
+        tfree(vals);
+        return;
+    }
+
+    t = tmalloc(sizeof(tile_t));
+    *t = (tile_t) {
+        .id = id, .tx = tx, .ty = ty, .zoom = zoom,
+        .generation = generation,
+        .vals = vals
+    };
+    size_t h = tile_hash(id, zoom, tx, ty);
+    t->next = cache.buckets[h];
+    cache.buckets[h] = t;
+    lru_push(t);
+    cache.num_tiles++;
+}
+
+// set the memory budget, evicting tiles if needed
+void tcache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&cache.lock);
+    cache.budget = bytes;
+    while (cache.num_tiles > bytes / TILE_BYTES)
+        tile_remove(cache.lru_last);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// drop all tiles of an expression
+void tcache_invalidate(int64_t id) {
+    pthread_mutex_lock(&cache.lock);
+    for (tile_t* t = cache.lru_first; t != NULL;) {
+        tile_t* next = t->lru_next;
+        if (t->id == id)
+            tile_remove(t);
+        t = next;
+    }
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// bytes held by the tiles of an expression
+size_t tcache_size(int64_t id) {
+    size_t size = 0;
+    pthread_mutex_lock(&cache.lock);
+    for (tile_t* t = cache.lru_first; t != NULL; t = t->lru_next)
+        if (t->id == id)
+            size += sizeof(tile_t) + TILE_BYTES;
+    pthread_mutex_unlock(&cache.lock);
+    return size;
+}
+
+// a tile that is in view but not in the cache
+struct missing {
+    int64_t tx, ty;
+    float* vals;
+};
+
+struct view_job {
+    const ir_prog_t* prog;
+    const view_t* view;
+    float* out;
+    size_t stride;
+    struct missing* missing;
+};
+
+// copy the part of a tile that is in view
+static void copy_tile(const view_t* v, int64_t tx, int64_t ty, const float* vals, float* out, size_t stride) {
+    int64_t x0 = tx * GRID_TILE_SIZE, y0 = ty * GRID_TILE_SIZE;
+    int64_t from_x = x0 > v->px ? x0 : v->px,
+            from_y = y0 > v->py ? y0 : v->py,
+            to_x = x0 + GRID_TILE_SIZE < v->px + (int64_t)v->width ? x0 + GRID_TILE_SIZE : v->px + (int64_t)v->width,
+            to_y = y0 + GRID_TILE_SIZE < v->py + (int64_t)v->height ? y0 + GRID_TILE_SIZE : v->py + (int64_t)v->height;
+
+    for (int64_t y = from_y; y < to_y; y++)
+        memcpy(out + (y - v->py) * stride + (from_x - v->px),
+               vals + (y - y0) * GRID_TILE_SIZE + (from_x - x0),
+               (to_x - from_x) * sizeof(float));
+}
+
+static void eval_missing(void* ctx, size_t begin, size_t end) {
+    struct view_job* job = ctx;
+    float size = ldexpf(1, -job->view->zoom) * GRID_TILE_SIZE;
+    for (size_t i = begin; i < end; i++) {
+        struct missing* m = &(job->missing[i]);
+        grid_t grid = {
+            .x0 = m->tx * size, .x1 = (m->tx + 1) * size,
+            .y0 = -(m->ty + 1) * size, .y1 = -m->ty * size,
+            .width = GRID_TILE_SIZE, .height = GRID_TILE_SIZE
+        };
+        m->vals = tmalloc(TILE_BYTES);
+        grid_eval(job->prog, &grid, m->vals, GRID_TILE_SIZE);
+        copy_tile(job->view, m->tx, m->ty, m->vals, job->out, job->stride);
+    }
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// evaluate a view of an expression, reusing cached tiles of the same
+// compilation of the expression and caching newly evaluated ones
+void tcache_eval_view(int64_t id, uint64_t generation, const ir_prog_t* prog,
+                      const view_t* v, float* out, size_t stride) {
+    if (v->width == 0 || v->height == 0)
+        return;
+
+    int64_t tx0 = floor_div(v->px, GRID_TILE_SIZE),
+            ty0 = floor_div(v->py, GRID_TILE_SIZE),
+            tx1 = floor_div(v->px + v->width - 1, GRID_TILE_SIZE),
+            ty1 = floor_div(v->py + v->height - 1, GRID_TILE_SIZE);
+    size_t num_tiles = (tx1 - tx0 + 1) * (ty1 - ty0 + 1), num_missing = 0;
+    struct missing* missing = tmalloc(num_tiles * sizeof(struct missing));
+
+    // copy out the tiles we have
+    pthread_mutex_lock(&cache.lock);
+    for (int64_t ty = ty0; ty <= ty1; ty++) {
+        for (int64_t tx = tx0; tx <= tx1; tx++) {
+            tile_t* t = tile_find(id, v->zoom, tx, ty);
+            if (t && t->generation == generation) {
+                copy_tile(v, tx, ty, t->vals, out, stride);
+                lru_unlink(t);
+                lru_push(t);
+            } else
+                missing[num_missing++] = (struct missing) { .tx = tx, .ty = ty };
+        }
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    // evaluate the rest in parallel
+    struct view_job job = {
+        .prog = prog,
+        .view = v,
+        .out = out,
+        .stride = stride,
+        .missing = missing
+    };
+    pool_for(num_missing, 1, &eval_missing, &job);
+
+    pthread_mutex_lock(&cache.lock);
+    for (size_t i = 0; i < num_missing; i++)
+        tile_insert(id, generation, v->zoom, missing[i].tx, missing[i].ty, missing[i].vals);
+    pthread_mutex_unlock(&cache.lock);
+    tfree(missing);
+}
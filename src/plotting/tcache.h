@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "runtime/ir.h"
+
+// default memory budget of the tile cache
+#define TCACHE_BUDGET_DEFAULT (64 << 20)
+
+// a view of an expression at a zoom level, in pixels
+// at zoom z a pixel is 2^-z units wide, and pixel (px, py) is centered
+// at x = (px + 0.5) * 2^-z, y = -(py + 0.5) * 2^-z
+typedef struct {
+    int zoom;
+    int64_t px, py;
+    size_t width, height;
+} view_t;
+
+void tcache_set_budget(size_t bytes);
+void tcache_invalidate(int64_t id);
+size_t tcache_size(int64_t id);
+void tcache_eval_view(int64_t id, uint64_t generation, const ir_prog_t* prog,
+                      const view_t* view, float* out, size_t stride);
@@ -0,0 +1,236 @@
+/*
+    Piecewise Chebyshev approximation of expressions in x
+    each piece is fitted by interpolating at Chebyshev points,
+    truncated to the tolerance and checked against the program
+    between the nodes, and halved until it passes. evaluating
+    a piece is then a Clenshaw recurrence of at most CHEB_DEGREE
+    steps, whatever the program costs
+*/
+
+#include <math.h>
+#include <float.h>
+#include "cheb.h"
+#include "runtime/rt.h"
+#include "utils/tmalloc.h"
+
+// state carried through fitting the pieces of an approximation
+struct fit {
+    const ir_prog_t* prog;
+    cheb_t* cheb;
+    float tol;
+};
+
+// evaluate the program at n values of x
+static void sample(const ir_prog_t* prog, const float* xs, float* out, size_t n) {
+    const float* inputs[RT_NUM_INPUTS] = { xs, NULL };
+    rt_eval_batch(prog, inputs, out, n);
+}
+
+static float clenshaw(const float* c, uint32_t degree, float t) {
+    float b1 = 0, b2 = 0;
+    for (uint32_t k = degree; k > 0; k--) {
+        float b0 = c[k] + 2*t*b1 - b2;
+        b2 = b1;
+        b1 = b0;
+    }
+    return c[0] + t*b1 - b2;
+}
+
+// fit the index-th of the 2^depth equal parts of the domain
+// returns false if a piece couldn't be fitted at the maximum depth
+static bool fit_piece(struct fit* f, uint32_t depth, uint32_t index) {
+    cheb_t* cheb = f->cheb;
+    double width = ((double)cheb->x1 - cheb->x0) / (1u << depth);
+    double a = cheb->x0 + index * width;
+    double mid = a + width / 2, half = width / 2;
+
+    // values at the Chebyshev extreme points, cos(pi j / n)
+    const int n = CHEB_DEGREE;
+    float xs[CHEB_DEGREE + 1], ys[CHEB_DEGREE + 1];
+    for (int j = 0; j <= n; j++)
+        xs[j] = mid + half * cos(M_PI * j / n);
+    sample(f->prog, xs, ys, n + 1);
+
+    bool finite = true;
+    for (int j = 0; j <= n; j++)
+        finite &= isfinite(ys[j]);
+
+    // interpolating coefficients, by the discrete cosine transform
+    double c[CHEB_DEGREE + 1];
+    for (int k = 0; finite && k <= n; k++) {
+        double sum = (ys[0] + (k % 2 ? -ys[n] : ys[n])) / 2;
+        for (int j = 1; j < n; j++)
+            sum += ys[j] * cos(M_PI * ((j * k) % (2*n)) / n);
+        c[k] = sum * 2 / n;
+    }
+    if (finite) {
+        c[0] /= 2;
+        c[n] /= 2;
+    }
+
+    // the series must have converged before it is truncated
+    bool resolved = finite;
+    for (int k = n - 2; resolved && k <= n; k++)
+        resolved = fabs(c[k]) <= f->tol / 8;
+
+    if (resolved) {
+        // drop the terms whose sum stays well within the tolerance
+        int degree = n;
+        double tail = 0;
+        while (degree > 0 && tail + fabs(c[degree]) <= f->tol / 4)
+            tail += fabs(c[degree--]);
+
+        uint32_t coeffs = cheb->coeffs.len;
+        for (int k = 0; k <= degree; k++)
+            vec_push(&(cheb->coeffs), (float)c[k]);
+
+        // check between the nodes, allowing for rounding of the values
+        float cx[CHEB_CHECKS], cy[CHEB_CHECKS];
+        for (int i = 0; i < CHEB_CHECKS; i++)
+            cx[i] = a + (i + 0.5) * width / CHEB_CHECKS;
+        sample(f->prog, cx, cy, CHEB_CHECKS);
+        float scale = 1 / half;
+        for (int i = 0; resolved && i < CHEB_CHECKS; i++) {
+            float t = (cx[i] - (float)mid) * scale;
+            float err = fabsf(clenshaw(cheb->coeffs.data + coeffs, degree, t) - cy[i]);
+            resolved = err <= f->tol + 8 * FLT_EPSILON * fabsf(cy[i]);
+        }
+
+        if (resolved) {
+            cheb_piece_t piece = {
+                .mid = mid, .scale = scale,
+                .coeffs = coeffs, .degree = degree,
+                .depth = depth, .index = index
+            };
+            vec_push(&(cheb->pieces), piece);
+            return true;
+        }
+        cheb->coeffs.len = coeffs;
+    }
+
+    if (depth == CHEB_MAX_DEPTH)
+        return false;
+    return fit_piece(f, depth + 1, 2*index) && fit_piece(f, depth + 1, 2*index + 1);
+}
+
+// check that a program only depends on x, and always gives
+// the same value for it
+static bool fittable(const ir_prog_t* prog) {
+    for (size_t i = 0; i < prog->insts.len; i++) {
+        const ir_inst_t* inst = &(prog->insts.data[i]);
+        if (inst->op == IR_INPUT && inst->input != 0)
+            return false;
+        if (inst->op == IR_CALL && !(inst->fn->flags & FN_PURE))
+            return false;
+    }
+    return true;
+}
+
+// approximate a program in x over [x0, x1] to within tol
+// NULL if it depends on anything else, or isn't smooth enough
+// to be approximated with at most 2^CHEB_MAX_DEPTH pieces
+cheb_t* cheb_fit(const ir_prog_t* prog, float x0, float x1, float tol) {
+    if (!(x0 < x1 && tol > 0) || !isfinite(x1 - x0) || !fittable(prog))
+        return NULL;
+
+    cheb_t* cheb = tmalloc(sizeof(cheb_t));
+    *cheb = (cheb_t) {
+        .x0 = x0, .x1 = x1, .tol = tol,
+        .pieces = vec_new(cheb_piece_t),
+        .coeffs = vec_new(float),
+        .lookup = vec_new(uint16_t),
+        .depth = 0
+    };
+
+    struct fit f = { .prog = prog, .cheb = cheb, .tol = tol };
+    if (!fit_piece(&f, 0, 0)) {
+        cheb_free(cheb);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cheb->pieces.len; i++)
+        if (cheb->pieces.data[i].depth > cheb->depth)
+            cheb->depth = cheb->pieces.data[i].depth;
+
+    // pieces are found in order, so each one covers
+    // the cells after the ones before it
+    for (size_t i = 0; i < cheb->pieces.len; i++) {
+        uint32_t cells = 1u << (cheb->depth - cheb->pieces.data[i].depth);
+        for (uint32_t j = 0; j < cells; j++)
+            vec_push(&(cheb->lookup), (uint16_t)i);
+    }
+    cheb->cells_per_unit = (1u << cheb->depth) / (x1 - x0);
+    return cheb;
+}
+
+// index of the piece covering x
+static inline uint32_t locate(const cheb_t* cheb, float x) {
+    float cell = (x - cheb->x0) * cheb->cells_per_unit;
+    float last = cheb->lookup.len - 1;
+    cell = cell < 0 ? 0 : cell > last ? last : cell;
+    return cheb->lookup.data[(uint32_t)cell];
+}
+
+// where x is in a piece, from -1 to 1
+static inline float piece_t(const cheb_piece_t* p, float x) {
+    float t = (x - p->mid) * p->scale;
+    return t < -1 ? -1 : t > 1 ? 1 : t;
+}
+
+// evaluate an approximation at x in its domain
+float cheb_eval(const cheb_t* cheb, float x) {
+    const cheb_piece_t* p = &(cheb->pieces.data[locate(cheb, x)]);
+    return clenshaw(cheb->coeffs.data + p->coeffs, p->degree, piece_t(p, x));
+}
+
+// run the recurrence of one piece for at most RT_BLOCK_SIZE
+// points side by side, so they don't wait on each other's multiplies
+static void clenshaw_run(const cheb_t* cheb, const cheb_piece_t* p, const float* xs, float* out, size_t n) {
+    const float* c = cheb->coeffs.data + p->coeffs;
+    float t[RT_BLOCK_SIZE], b1[RT_BLOCK_SIZE], b2[RT_BLOCK_SIZE];
+    for (size_t j = 0; j < n; j++) {
+        t[j] = piece_t(p, xs[j]);
+        b1[j] = b2[j] = 0;
+    }
+    for (uint32_t k = p->degree; k > 0; k--) {
+        for (size_t j = 0; j < n; j++) {
+            float b0 = c[k] + 2*t[j]*b1[j] - b2[j];
+            b2[j] = b1[j];
+            b1[j] = b0;
+        }
+    }
+    for (size_t j = 0; j < n; j++)
+        out[j] = c[0] + t[j]*b1[j] - b2[j];
+}
+
+// evaluate an approximation at n values of x in its domain
+// points next to each other usually fall in the same piece,
+// so they are evaluated in runs sharing the coefficients
+void cheb_eval_batch(const cheb_t* cheb, const float* xs, float* out, size_t n) {
+    for (size_t i = 0; i < n; i += RT_BLOCK_SIZE) {
+        size_t len = n - i < RT_BLOCK_SIZE ? n - i : RT_BLOCK_SIZE;
+        uint32_t pieces[RT_BLOCK_SIZE];
+        for (size_t j = 0; j < len; j++)
+            pieces[j] = locate(cheb, xs[i + j]);
+
+        for (size_t j = 0; j < len;) {
+            size_t end = j + 1;
+            while (end < len && pieces[end] == pieces[j])
+                end++;
+            clenshaw_run(cheb, &(cheb->pieces.data[pieces[j]]), xs + i + j, out + i + j, end - j);
+            j = end;
+        }
+    }
+}
+
+void cheb_free(cheb_t* cheb) {
+    vec_destruct(&(cheb->pieces));
+    vec_destruct(&(cheb->coeffs));
+    vec_destruct(&(cheb->lookup));
+    tfree(cheb);
+}
+
+// bytes held by an approximation
+size_t cheb_size(const cheb_t* cheb) {
+    return sizeof(cheb_t) + cheb->pieces.alloc_size + cheb->coeffs.alloc_size + cheb->lookup.alloc_size;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "runtime/ir.h"
+#include "utils/vector.h"
+
+// degree of the series fitted to each piece, kept low so
+// evaluating one is cheap, domains being split up instead
+#define CHEB_DEGREE 16
+
+// points between the nodes each piece is checked at
+#define CHEB_CHECKS 256
+
+// how many times the domain can be halved, which
+// bounds the number of pieces to 2^CHEB_MAX_DEPTH
+#define CHEB_MAX_DEPTH 10
+
+// a Chebyshev series over one piece of the domain
+typedef struct {
+    // maps the piece to [-1, 1]
+    float mid, scale;
+
+    // coefficients 0..degree, in the approximation's pool
+    uint32_t coeffs, degree;
+
+    // the piece is the index-th of the 2^depth equal parts of the domain
+    uint32_t depth, index;
+} cheb_piece_t;
+
+// piecewise Chebyshev approximation of a program in x over [x0, x1]
+typedef struct {
+    float x0, x1, tol;
+
+    // pieces in ascending order, and the one covering
+    // each of the 2^depth equal parts of the domain
+    vec_struct(cheb_piece_t) pieces;
+    vec_struct(float) coeffs;
+    vec_struct(uint16_t) lookup;
+    uint32_t depth;
+    float cells_per_unit;
+} cheb_t;
+
+cheb_t* cheb_fit(const ir_prog_t* prog, float x0, float x1, float tol);
+float cheb_eval(const cheb_t* cheb, float x);
+void cheb_eval_batch(const cheb_t* cheb, const float* xs, float* out, size_t n);
+void cheb_free(cheb_t* cheb);
+size_t cheb_size(const cheb_t* cheb);
+
+// check whether x is in the domain of an approximation
+static inline bool cheb_covers(const cheb_t* cheb, float x) {
+    return x >= cheb->x0 && x <= cheb->x1;
+}
@@ -0,0 +1,221 @@
+#include <math.h>
+#include <string.h>
+#include "runtime/rt.h"
+#include "runtime/ir.h"
+#include "utils/tmalloc.h"
+
+// evaluate a single instruction, given the values of earlier ones
+float rt_eval_inst(const ir_prog_t* prog, const ir_inst_t* inst, const float regs[]) {
+    #define A(n) regs[IR_ARG(prog, inst, n)]
+    switch (inst->op) {
+        case IR_CONST: return inst->imm;
+        case IR_ADD: return A(0) + A(1);
+        case IR_SUB: return A(0) - A(1);
+        case IR_MUL: return A(0) * A(1);
+        case IR_DIV: return A(0) / A(1);
+        case IR_POW: return powf(A(0), A(1));
+        case IR_LT: return A(0) < A(1);
+        case IR_LE: return A(0) <= A(1);
+        case IR_EQ: return A(0) == A(1);
+        case IR_NE: return A(0) != A(1);
+        case IR_AND: return (A(0) != 0) & (A(1) != 0);
+        case IR_OR: return (A(0) != 0) | (A(1) != 0);
+        case IR_SELECT: return A(0) != 0 ? A(1) : A(2);
+
+        case IR_CALL: {
+            float args[inst->num_args];
+            for (uint32_t j = 0; j < inst->num_args; j++)
+                args[j] = A(j);
+            return inst->fn->eval(inst->num_args, args);
+        }
+
+        default:
+            // inputs are handled by the caller
+            return NAN;
+    }
+    #undef A
+}
+
+// evaluate a program at a point
+float rt_eval(const ir_prog_t* prog, const float inputs[]) {
+    float regs[prog->insts.len];
+    ir_counter_t* counters = rt_profiling_enabled() ? rt_profile_counters(prog) : NULL;
+    for (size_t i = 0; i < prog->insts.len; i++) {
+        const ir_inst_t* inst = &(prog->insts.data[i]);
+        uint64_t start = counters ? rt_cycles() : 0;
+        if (inst->op == IR_INPUT)
+            regs[i] = inputs[inst->input];
+        else
+            regs[i] = rt_eval_inst(prog, inst, regs);
+        if (counters)
+            rt_profile_add(&(counters[i]), 1, rt_cycles() - start);
+    }
+    return regs[prog->insts.len - 1];
+}
+
+// run instruction i over a block of at most RT_BLOCK_SIZE points
+static void eval_inst_block(const ir_prog_t* prog, size_t i, const float* inputs[], size_t n, float* regs) {
+    const ir_inst_t* inst = &(prog->insts.data[i]);
+    float* r = regs + i * RT_BLOCK_SIZE;
+    #define A(n) (regs + IR_ARG(prog, inst, n) * RT_BLOCK_SIZE)
+
+    switch (inst->op) {
+        case IR_CONST: {
+            for (size_t j = 0; j < n; j++)
+                r[j] = inst->imm;
+        } break;
+
+        case IR_INPUT: {
+            if (inputs[inst->input])
+                memcpy(r, inputs[inst->input], n * sizeof(float));
+            else
+                memset(r, 0, n * sizeof(float));
+        } break;
+
+        case IR_ADD: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] + b[j];
+        } break;
+
+        case IR_SUB: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] - b[j];
+        } break;
+
+        case IR_MUL: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] * b[j];
+        } break;
+
+        case IR_DIV: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] / b[j];
+        } break;
+
+        case IR_POW: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = powf(a[j], b[j]);
+        } break;
+
+        // comparisons and selects don't branch, so they compile
+        // to vector compares and blends. both sides of a select
+        // have already been evaluated for the whole block
+        case IR_LT: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] < b[j];
+        } break;
+
+        case IR_LE: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] <= b[j];
+        } break;
+
+        case IR_EQ: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] == b[j];
+        } break;
+
+        case IR_NE: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = a[j] != b[j];
+        } break;
+
+        case IR_AND: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = (a[j] != 0) & (b[j] != 0);
+        } break;
+
+        case IR_OR: {
+            const float *a = A(0), *b = A(1);
+            for (size_t j = 0; j < n; j++)
+                r[j] = (a[j] != 0) | (b[j] != 0);
+        } break;
+
+        case IR_SELECT: {
+            const float *c = A(0), *a = A(1), *b = A(2);
+            for (size_t j = 0; j < n; j++)
+                r[j] = c[j] != 0 ? a[j] : b[j];
+        } break;
+
+        case IR_CALL: {
+            const float* args[inst->num_args];
+            for (uint32_t k = 0; k < inst->num_args; k++)
+                args[k] = A(k);
+
+            if (inst->fn->eval_batch) {
+                inst->fn->eval_batch(inst->num_args, args, r, n);
+            } else {
+                // fall back to calling the scalar variant per point
+                float a[inst->num_args];
+                for (size_t j = 0; j < n; j++) {
+                    for (uint32_t k = 0; k < inst->num_args; k++)
+                        a[k] = args[k][j];
+                    r[j] = inst->fn->eval(inst->num_args, a);
+                }
+            }
+        } break;
+    }
+    #undef A
+}
+
+// evaluate one block of at most RT_BLOCK_SIZE points
+// each instruction is run over the whole block before the next one
+static void eval_block(const ir_prog_t* prog, const float* inputs[], float* out, size_t n, float* regs) {
+    if (rt_profiling_enabled()) {
+        ir_counter_t* counters = rt_profile_counters(prog);
+        for (size_t i = 0; i < prog->insts.len; i++) {
+            uint64_t start = rt_cycles();
+            eval_inst_block(prog, i, inputs, n, regs);
+            rt_profile_add(&(counters[i]), n, rt_cycles() - start);
+        }
+    } else {
+        for (size_t i = 0; i < prog->insts.len; i++)
+            eval_inst_block(prog, i, inputs, n, regs);
+    }
+    memcpy(out, regs + (prog->insts.len - 1) * RT_BLOCK_SIZE, n * sizeof(float));
+}
+
+// evaluate a program at n points
+// inputs[i][j] is input i of point j, a NULL input reads as 0
+void rt_eval_batch(const ir_prog_t* prog, const float* inputs[], float* out, size_t n) {
+    float* regs = tmalloc(prog->insts.len * RT_BLOCK_SIZE * sizeof(float));
+    for (size_t i = 0; i < n; i += RT_BLOCK_SIZE) {
+        const float* block[RT_NUM_INPUTS];
+        for (int k = 0; k < RT_NUM_INPUTS; k++)
+            block[k] = inputs[k] ? inputs[k] + i : NULL;
+
+        size_t len = n - i < RT_BLOCK_SIZE ? n - i : RT_BLOCK_SIZE;
+        eval_block(prog, block, out + i, len, regs);
+    }
+    tfree(regs);
+}
+
+// evaluate a program at n points, keeping the values of several of
+// its instructions: outs[k][j] is instruction results[k] at point j
+// programs made by rt_fuse aren't profiled
+void rt_eval_batch_multi(const ir_prog_t* prog, const uint32_t results[], size_t num_results,
+                         const float* inputs[], float* outs[], size_t n) {
+    float* regs = tmalloc(prog->insts.len * RT_BLOCK_SIZE * sizeof(float));
+    for (size_t i = 0; i < n; i += RT_BLOCK_SIZE) {
+        const float* block[RT_NUM_INPUTS];
+        for (int k = 0; k < RT_NUM_INPUTS; k++)
+            block[k] = inputs[k] ? inputs[k] + i : NULL;
+
+        size_t len = n - i < RT_BLOCK_SIZE ? n - i : RT_BLOCK_SIZE;
+        for (size_t j = 0; j < prog->insts.len; j++)
+            eval_inst_block(prog, j, block, len, regs);
+        for (size_t k = 0; k < num_results; k++)
+            memcpy(outs[k] + i, regs + results[k] * RT_BLOCK_SIZE, len * sizeof(float));
+    }
+    tfree(regs);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "utils/vector.h"
+
+struct function;
+
+// intermediate representation of an expression
+// a program is a list of instructions in evaluation order,
+// each producing one value, referred to by its index
+typedef enum {
+    IR_CONST,
+    IR_INPUT,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_POW,
+    IR_LT,
+    IR_LE,
+    IR_EQ,
+    IR_NE,
+    IR_AND,
+    IR_OR,
+    IR_SELECT,                      // args[0] != 0 ? args[1] : args[2]
+    IR_CALL
+} ir_op_t;
+
+typedef struct {
+    ir_op_t op;
+
+    // arguments are indices of earlier instructions,
+    // stored in the program's argument pool
+    uint32_t num_args, args;
+
+    union {
+        float imm;                  // IR_CONST
+        int input;                  // IR_INPUT
+        const struct function* fn;  // IR_CALL
+    };
+
+    // position of the source of this instruction in expression string,
+    // and of the whole subtree it computes
+    int str_pos, str_len;
+    int tree_pos, tree_len;
+} ir_inst_t;
+
+// executions and cycles spent in an instruction, while profiling
+typedef struct {
+    atomic_uint_fast64_t count, cycles;
+} ir_counter_t;
+
+typedef struct {
+    vec_struct(ir_inst_t) insts;
+    vec_struct(uint32_t) args;
+
+    // one per instruction, allocated the first time
+    // the program is evaluated while profiling
+    _Atomic(ir_counter_t*) counters;
+} ir_prog_t;
+
+#define IR_ARG(prog, inst, i) ((prog)->args.data[(inst)->args + (i)])
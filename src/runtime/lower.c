@@ -0,0 +1,94 @@
+#include "runtime/rt.h"
+#include "runtime/ir.h"
+#include "expression.h"
+#include "parsing/ast.h"
+
+// opcodes of the inline operators
+static ir_op_t ir_ops[UINT8_MAX + 1] = {
+    ['+'] = IR_ADD,
+    ['-'] = IR_SUB,
+    ['*'] = IR_MUL,
+    ['/'] = IR_DIV,
+    ['^'] = IR_POW,
+    ['<'] = IR_LT,
+    ['>'] = IR_LT,
+    [OP_LE] = IR_LE,
+    [OP_GE] = IR_LE,
+    [OP_EQ] = IR_EQ,
+    [OP_NE] = IR_NE,
+    [OP_AND] = IR_AND,
+    [OP_OR] = IR_OR
+};
+
+// operators lowered with their arguments swapped
+static bool swapped[UINT8_MAX + 1] = {
+    ['>'] = true,
+    [OP_GE] = true
+};
+
+// convert the resolved AST into a program, one instruction per node
+// function definitions have no value and produce no program
+int rt_lower(expr_t* expr) {
+    const ast_t* ast = &(expr->ast);
+    if (ast_is_def(ast))
+        return 0;
+
+    ir_prog_t* prog = tmalloc(sizeof(ir_prog_t));
+    *prog = (ir_prog_t) {
+        .insts = vec_new(ir_inst_t),
+        .args = vec_new(uint32_t)
+    };
+
+    // nodes are in post-order, so arguments always come first
+    for (uint32_t i = 0; i < ast->nodes.len; i++) {
+        const ast_node_t* t = AST_NODE(ast, i);
+        ir_inst_t inst = {
+            .num_args = t->num_children,
+            .args = prog->args.len,
+            .str_pos = ast->spans.data[i].pos,
+            .str_len = ast->spans.data[i].len
+        };
+        int from = inst.str_pos, to = inst.str_pos + inst.str_len;
+        for (uint32_t j = 0; j < t->num_children; j++) {
+            uint32_t k = t->type == NODE_TYPE_OPERATOR && swapped[t->op] ? t->num_children - 1 - j : j;
+            vec_push(&(prog->args), AST_CHILD(ast, t, k));
+
+            const ir_inst_t* arg = &(prog->insts.data[AST_CHILD(ast, t, k)]);
+            if (arg->tree_pos < from)
+                from = arg->tree_pos;
+            if (arg->tree_pos + arg->tree_len > to)
+                to = arg->tree_pos + arg->tree_len;
+        }
+        inst.tree_pos = from;
+        inst.tree_len = to - from;
+
+        switch (t->type) {
+            case NODE_TYPE_LITERAL:
+                inst.op = IR_CONST;
+                inst.imm = t->literal;
+                break;
+
+            case NODE_TYPE_VARIABLE:
+                inst.op = IR_INPUT;
+                inst.input = t->input;
+                break;
+
+            case NODE_TYPE_OPERATOR:
+                inst.op = ir_ops[t->op];
+                break;
+
+            case NODE_TYPE_FUNCTION:
+                inst.op = t->fn->op;
+                if (inst.op == IR_CALL)
+                    inst.fn = t->fn;
+                break;
+
+            case NODE_TYPE_PARAM:
+                // only present in bodies of definitions, which are never lowered
+                break;
+        }
+        vec_push(&(prog->insts), inst);
+    }
+    expr->prog = prog;
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include <string.h>
+#include "runtime/rt.h"
+#include "runtime/ir.h"
+#include "expression.h"
+
+// can the instruction be folded and shared with identical ones
+static bool is_pure(const ir_inst_t* inst) {
+    return inst->op != IR_CALL || (inst->fn->flags & FN_PURE);
+}
+
+static uint32_t hash_inst(const ir_prog_t* prog, const ir_inst_t* inst) {
+    uint32_t h = inst->op * 2654435761u;
+    switch (inst->op) {
+        case IR_CONST: {
+            uint32_t bits;
+            memcpy(&bits, &(inst->imm), sizeof(bits));
+            h ^= bits;
+        } break;
+        case IR_INPUT: h ^= inst->input; break;
+        case IR_CALL: h ^= (uint32_t)(uintptr_t)inst->fn; break;
+        default: break;
+    }
+    for (uint32_t i = 0; i < inst->num_args; i++)
+        h = (h ^ IR_ARG(prog, inst, i)) * 16777619u;
+    return h;
+}
+
+static bool same_inst(const ir_prog_t* prog, const ir_inst_t* a, const ir_inst_t* b) {
+    if (a->op != b->op || a->num_args != b->num_args)
+        return false;
+    if (a->op == IR_CONST && memcmp(&(a->imm), &(b->imm), sizeof(a->imm)) != 0)
+        return false;
+    if (a->op == IR_INPUT && a->input != b->input)
+        return false;
+    if (a->op == IR_CALL && a->fn != b->fn)
+        return false;
+    for (uint32_t i = 0; i < a->num_args; i++)
+        if (IR_ARG(prog, a, i) != IR_ARG(prog, b, i))
+            return false;
+    return true;
+}
+
+// fold instructions with constant arguments and merge identical instructions
+// (common subexpression elimination), then drop everything that doesn't
+// contribute to the result
+int rt_optimize(expr_t* expr) {
+    ir_prog_t* prog = expr->prog;
+    if (prog == NULL)
+        return 0;
+
+    size_t n = prog->insts.len;
+    ir_prog_t opt = {
+        .insts = vec_new(ir_inst_t),
+        .args = vec_new(uint32_t)
+    };
+
+    // remap[i] is the new index of instruction i
+    uint32_t* remap = tmalloc(n * sizeof(uint32_t));
+
+    // open addressed table of instructions in the new program
+    size_t table_size = 2 * n;
+    uint32_t* table = tmalloc(table_size * sizeof(uint32_t));
+    memset(table, 0xff, table_size * sizeof(uint32_t));
+
+    // values of constant instructions, indexed like the new program
+    float* consts = tmalloc(n * sizeof(float));
+
+    for (size_t i = 0; i < n; i++) {
+        ir_inst_t inst = prog->insts.data[i];
+
+        // rewrite arguments into the new program
+        uint32_t args = opt.args.len;
+        bool all_const = inst.num_args > 0;
+        for (uint32_t j = 0; j < inst.num_args; j++) {
+            uint32_t a = remap[IR_ARG(prog, &inst, j)];
+            all_const &= opt.insts.data[a].op == IR_CONST;
+            vec_push(&(opt.args), a);
+        }
+        inst.args = args;
+
+        // a select with a known condition is one of its arguments
+        if (inst.op == IR_SELECT && opt.insts.data[IR_ARG(&opt, &inst, 0)].op == IR_CONST) {
+            bool cond = consts[IR_ARG(&opt, &inst, 0)] != 0;
+            remap[i] = IR_ARG(&opt, &inst, cond ? 1 : 2);
+            opt.args.len = args;
+            continue;
+        }
+
+        if (is_pure(&inst) && all_const) {
+            float val = rt_eval_inst(&opt, &inst, consts);
+            opt.args.len = args;
+            inst = (ir_inst_t) {
+                .op = IR_CONST,
+                .num_args = 0,
+                .args = args,
+                .imm = val,
+                .str_pos = inst.str_pos,
+                .str_len = inst.str_len,
+                .tree_pos = inst.tree_pos,
+                .tree_len = inst.tree_len
+            };
+        }
+
+        // look for an identical instruction
+        uint32_t h = hash_inst(&opt, &inst) % table_size;
+        if (is_pure(&inst)) {
+            for (; table[h] != UINT32_MAX; h = (h + 1) % table_size) {
+                if (same_inst(&opt, &(opt.insts.data[table[h]]), &inst))
+                    break;
+            }
+            if (table[h] != UINT32_MAX) {
+                opt.args.len = args;
+                remap[i] = table[h];
+                continue;
+            }
+        }
+
+        remap[i] = opt.insts.len;
+        if (inst.op == IR_CONST)
+            consts[opt.insts.len] = inst.imm;
+        if (is_pure(&inst))
+            table[h] = opt.insts.len;
+        vec_push(&(opt.insts), inst);
+    }
+
+    // mark instructions the result depends on, all of
+    // which come before it since arguments always do
+    uint32_t result = remap[n - 1];
+    bool* live = tmalloc(result + 1);
+    memset(live, 0, result + 1);
+    live[result] = true;
+    for (uint32_t i = result + 1; i-- > 0;) {
+        const ir_inst_t* inst = &(opt.insts.data[i]);
+        if (!live[i])
+            continue;
+        for (uint32_t j = 0; j < inst->num_args; j++)
+            live[IR_ARG(&opt, inst, j)] = true;
+    }
+
+    // compact the live instructions into the program
+    prog->insts.len = 0;
+    prog->args.len = 0;
+    for (uint32_t i = 0; i <= result; i++) {
+        if (!live[i])
+            continue;
+        ir_inst_t inst = opt.insts.data[i];
+        uint32_t args = prog->args.len;
+        for (uint32_t j = 0; j < inst.num_args; j++)
+            vec_push(&(prog->args), remap[IR_ARG(&opt, &inst, j)]);
+        inst.args = args;
+        remap[i] = prog->insts.len;
+        vec_push(&(prog->insts), inst);
+    }
+
+    tfree(remap);
+    tfree(table);
+    tfree(consts);
+    tfree(live);
+    vec_destruct(&(opt.insts));
+    vec_destruct(&(opt.args));
+    return 0;
+}
+
+// merge programs into one computing all their results, in which
+// identical instructions of different programs are shared
+// results[i] receives the index of the result of progs[i]
+ir_prog_t* rt_fuse(const ir_prog_t* const progs[], size_t n, uint32_t results[]) {
+    size_t total = 0, longest = 0;
+    for (size_t p = 0; p < n; p++) {
+        total += progs[p]->insts.len;
+        if (progs[p]->insts.len > longest)
+            longest = progs[p]->insts.len;
+    }
+
+    ir_prog_t* fused = tmalloc(sizeof(ir_prog_t));
+    *fused = (ir_prog_t) {
+        .insts = vec_new(ir_inst_t),
+        .args = vec_new(uint32_t)
+    };
+
+    // remap[i] is the index of instruction i of the current program
+    uint32_t* remap = tmalloc(longest * sizeof(uint32_t));
+
+    // open addressed table of instructions in the fused program
+    size_t table_size = 2 * total;
+    uint32_t* table = tmalloc(table_size * sizeof(uint32_t));
+    memset(table, 0xff, table_size * sizeof(uint32_t));
+
+    for (size_t p = 0; p < n; p++) {
+        const ir_prog_t* prog = progs[p];
+        for (size_t i = 0; i < prog->insts.len; i++) {
+            ir_inst_t inst = prog->insts.data[i];
+            uint32_t args = fused->args.len;
+            for (uint32_t j = 0; j < inst.num_args; j++)
+                vec_push(&(fused->args), remap[IR_ARG(prog, &inst, j)]);
+            inst.args = args;
+
+            uint32_t h = hash_inst(fused, &inst) % table_size;
+            if (is_pure(&inst)) {
+                for (; table[h] != UINT32_MAX; h = (h + 1) % table_size) {
+                    if (same_inst(fused, &(fused->insts.data[table[h]]), &inst))
+                        break;
+                }
+                if (table[h] != UINT32_MAX) {
+                    fused->args.len = args;
+                    remap[i] = table[h];
+                    continue;
+                }
+                table[h] = fused->insts.len;
+            }
+            remap[i] = fused->insts.len;
+            vec_push(&(fused->insts), inst);
+        }
+        results[p] = remap[prog->insts.len - 1];
+    }
+
+    tfree(remap);
+    tfree(table);
+    return fused;
+}
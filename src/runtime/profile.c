@@ -0,0 +1,125 @@
+/*
+    Opt-in profiling of evaluation
+    while enabled, evaluating a program counts executions and cycles
+    per instruction, which can be reported per subtree, mapped back
+    to the part of the source string the subtree came from
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "runtime/rt.h"
+#include "runtime/ir.h"
+#include "utils/tmalloc.h"
+
+static atomic_bool profiling;
+
+void rt_set_profiling(bool enabled) {
+    atomic_store(&profiling, enabled);
+}
+
+bool rt_profiling_enabled(void) {
+    return atomic_load_explicit(&profiling, memory_order_relaxed);
+}
+
+// a timestamp in cycles, or nanoseconds where cycles can't be read
+uint64_t rt_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// get the counters of a program, allocating them if needed
+ir_counter_t* rt_profile_counters(const ir_prog_t* prog) {
+    ir_prog_t* p = (ir_prog_t*)prog;
+    ir_counter_t* counters = atomic_load_explicit(&(p->counters), memory_order_acquire);
+    if (counters)
+        return counters;
+
+    counters = tmalloc(prog->insts.len * sizeof(ir_counter_t));
+    memset(counters, 0, prog->insts.len * sizeof(ir_counter_t));
+
+    // another thread may have got there first
+    ir_counter_t* expected = NULL;
+    if (!atomic_compare_exchange_strong(&(p->counters), &expected, counters)) {
+        tfree(counters);
+        return expected;
+    }
+    return counters;
+}
+
+void rt_profile_add(ir_counter_t* counter, uint64_t count, uint64_t cycles) {
+    atomic_fetch_add_explicit(&(counter->count), count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(counter->cycles), cycles, memory_order_relaxed);
+}
+
+void rt_profile_reset(const ir_prog_t* prog) {
+    ir_counter_t* counters = atomic_load(&(((ir_prog_t*)prog)->counters));
+    for (size_t i = 0; counters && i < prog->insts.len; i++) {
+        atomic_store(&(counters[i].count), 0);
+        atomic_store(&(counters[i].cycles), 0);
+    }
+}
+
+static int by_cycles(const void* a, const void* b) {
+    const prof_entry_t *x = a, *y = b;
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+// write at most max subtrees of a profiled program into out, the ones
+// the most cycles were spent in first. instructions shared between
+// subtrees count towards each of them, though their source is only
+// part of the first subtree they were found in. returns the number written
+size_t rt_profile_report(const ir_prog_t* prog, prof_entry_t* out, size_t max) {
+    ir_counter_t* counters = atomic_load(&(((ir_prog_t*)prog)->counters));
+    size_t n = prog->insts.len;
+    if (counters == NULL || n == 0)
+        return 0;
+
+    prof_entry_t* entries = tmalloc(n * sizeof(prof_entry_t));
+    uint32_t* seen = tmalloc(n * sizeof(uint32_t));
+    uint32_t* stack = tmalloc(n * sizeof(uint32_t));
+    memset(seen, 0xff, n * sizeof(uint32_t));
+
+    // walk the subtree of every instruction, marking what
+    // has been visited with the index of its root
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t cycles = 0;
+        size_t depth = 0;
+        stack[depth++] = i;
+        seen[i] = i;
+        while (depth > 0) {
+            const ir_inst_t* inst = &(prog->insts.data[stack[--depth]]);
+            cycles += atomic_load_explicit(&(counters[inst - prog->insts.data].cycles), memory_order_relaxed);
+
+            for (uint32_t j = 0; j < inst->num_args; j++) {
+                uint32_t a = IR_ARG(prog, inst, j);
+                if (seen[a] != i) {
+                    seen[a] = i;
+                    stack[depth++] = a;
+                }
+            }
+        }
+
+        // positions exclude the parentheses added around the source
+        entries[i] = (prof_entry_t) {
+            .pos = prog->insts.data[i].tree_pos - 1,
+            .len = prog->insts.data[i].tree_len,
+            .count = atomic_load_explicit(&(counters[i].count), memory_order_relaxed),
+            .self_cycles = atomic_load_explicit(&(counters[i].cycles), memory_order_relaxed),
+            .cycles = cycles
+        };
+    }
+    qsort(entries, n, sizeof(prof_entry_t), &by_cycles);
+
+    size_t len = n < max ? n : max;
+    memcpy(out, entries, len * sizeof(prof_entry_t));
+    tfree(entries);
+    tfree(seen);
+    tfree(stack);
+    return len;
+}
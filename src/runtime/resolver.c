@@ -1,44 +1,437 @@
+#include <string.h>
 #include "utils/vector.h"
 #include "runtime/rt.h"
 #include "expression.h"
 #include "parsing/ast.h"
 #include "error.h"
 
-static int resolve_subtree(expr_t* expr, ast_node_t* t, int errors) {
-    // only functions and variables need to be resolved
-    if (t->type == NODE_TYPE_FUNCTION || t->type == NODE_TYPE_VARIABLE) {
-        hm_elem_t* e = hm_get(expr->name_table, t->token.data.name_id);
+// state carried through the resolution of an expression
+struct resolver {
+    expr_t* expr;
+
+    // the LHS of the definition being resolved, if any,
+    // and the function it replaces
+    const ast_node_t* def;
+    const function_t* self;
+    int errors;
+
+    // names already reported as unresolvable
+    vec_struct(int32_t) unresolved;
+};
+
+// report an unresolvable name, only once per name
+static void unresolved(struct resolver* r, uint32_t i, int code) {
+    int32_t name = AST_NODE(&(r->expr->ast), i)->name_id;
+    for (size_t j = 0; j < r->unresolved.len; j++)
+        if (r->unresolved.data[j] == name)
+            return;
+
+    error_at_span(code, r->expr, r->expr->ast.spans.data[i]);
+
+    // mark it as unresolvable and increment error count
+    vec_push(&(r->unresolved), name);
+    r->errors++;
+}
 
-        // unresolvable, don't bother with it
-        if (e->data == UINT64_MAX)
-            goto next;
+static void error(struct resolver* r, uint32_t i, int code) {
+    error_at_span(code, r->expr, r->expr->ast.spans.data[i]);
+    r->errors++;
+}
 
-        if (t->type == NODE_TYPE_FUNCTION)
-            e->data = (uint64_t)rt_get_fn(e->str);
-        else if (t->type == NODE_TYPE_VARIABLE) {
-            // TODO
+// check whether a user-defined function calls another, directly or not
+static bool calls(const ast_t* body, const function_t* target) {
+    for (size_t i = 0; i < body->nodes.len; i++) {
+        const ast_node_t* t = AST_NODE(body, i);
+        if (t->type == NODE_TYPE_FUNCTION && t->fn->body) {
+            if (t->fn == target || calls(t->fn->body, target))
+                return true;
         }
-        
-        // name not found
-        if (e->data == 0) {
-            error_at_token("could not resolve name", expr, &(t->token));
-
-            // mark it as unresolvable and increment error count
-            e->data = UINT64_MAX;
-            errors++;
+    }
+    return false;
+}
+
+static void resolve_node(struct resolver* r, uint32_t i) {
+    const ast_t* ast = &(r->expr->ast);
+    ast_node_t* t = AST_NODE(ast, i);
+
+    // definitions are only allowed at the top level
+    if (t->type == NODE_TYPE_OPERATOR && t->op == '=') {
+        error(r, i, LG_ERR_NESTED_DEFINITION);
+        return;
+    }
+
+    // only functions and variables need to be resolved
+    if (t->type != NODE_TYPE_FUNCTION && t->type != NODE_TYPE_VARIABLE)
+        return;
+
+    int32_t name = t->name_id;
+    if (t->type == NODE_TYPE_VARIABLE) {
+        // parameters of the function being defined
+        if (r->def) {
+            for (uint32_t j = 0; j < r->def->num_children; j++) {
+                if (AST_NODE(ast, AST_CHILD(ast, r->def, j))->name_id == name) {
+                    t->type = NODE_TYPE_PARAM;
+                    t->param = j;
+                    return;
+                }
+            }
+        }
+
+        // plot inputs
+        int input = rt_get_input_id(name);
+        if (input != -1) {
+            t->input = input;
+            return;
         }
     }
 
-next:
-    // recursively operate on children
-    vec_iterate(&(t->children), c) {
-        resolve_subtree(expr, c, errors);
-    } vec_iterate_end(&(t->children));
-    return errors;
+    function_t* fn = rt_get_fn_id(name);
+    if (fn == NULL) {
+        unresolved(r, i, LG_ERR_UNRESOLVED_NAME);
+        return;
+    }
+
+    // variables are user-defined functions with no arguments
+    int num_args = t->type == NODE_TYPE_VARIABLE ? 0 : t->num_children;
+    if (t->type == NODE_TYPE_VARIABLE && fn->body == NULL) {
+        unresolved(r, i, LG_ERR_NOT_A_VARIABLE);
+        return;
+    }
+    if (fn->num_args == -1 ? num_args == 0 : fn->num_args != num_args) {
+        error(r, i, LG_ERR_WRONG_NUM_ARGS);
+        return;
+    }
+
+    // a definition can't depend on itself
+    if (r->self && fn->body && (fn == r->self || calls(fn->body, r->self))) {
+        error(r, i, LG_ERR_CIRCULAR_DEFINITION);
+        return;
+    }
+
+    // calls to user-defined functions are expanded later
+    t->type = NODE_TYPE_FUNCTION;
+    t->fn = fn;
 }
 
+// check the LHS of a definition
+static void resolve_def(struct resolver* r, uint32_t lhs) {
+    const ast_t* ast = &(r->expr->ast);
+    const ast_node_t* t = AST_NODE(ast, lhs);
+    function_t* fn = rt_get_fn_id(t->name_id);
+    if (rt_get_input_id(t->name_id) != -1 || (fn && fn->body == NULL))
+        error(r, lhs, LG_ERR_REDEFINED_BUILTIN);
+
+    // parameters must be distinct names
+    for (uint32_t i = 0; i < t->num_children; i++) {
+        uint32_t p = AST_CHILD(ast, t, i);
+        if (AST_NODE(ast, p)->type != NODE_TYPE_VARIABLE) {
+            error(r, p, LG_ERR_BAD_PARAMETER);
+            continue;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (AST_NODE(ast, AST_CHILD(ast, t, j))->name_id == AST_NODE(ast, p)->name_id)
+                error(r, p, LG_ERR_DUPLICATE_PARAMETER);
+        }
+    }
+}
 
 int rt_resolve(expr_t* expr) {
-    int errors = resolve_subtree(expr, expr->ast_root, 0);
-    return -1 * (errors > 0);
+    struct resolver r = {
+        .expr = expr,
+        .def = NULL,
+        .self = NULL,
+        .errors = 0,
+        .unresolved = { 0 }
+    };
+
+    // nodes are in post-order, so a node's arguments are
+    // always resolved before it
+    const ast_t* ast = &(expr->ast);
+    uint32_t root = AST_ROOT(ast);
+    if (ast_is_def(ast)) {
+        uint32_t lhs = AST_CHILD(ast, AST_NODE(ast, root), 0);
+        r.def = AST_NODE(ast, lhs);
+        r.self = rt_get_fn_id(r.def->name_id);
+        resolve_def(&r, lhs);
+        root = AST_CHILD(ast, AST_NODE(ast, root), 1);
+    }
+    for (uint32_t i = ast_subtree_start(ast, root); i <= root; i++)
+        resolve_node(&r, i);
+
+    if (r.unresolved.data)
+        vec_destruct(&(r.unresolved));
+    return -1 * (r.errors > 0);
+}
+
+// note the version of a user-defined function that was inlined
+static void add_dep(expr_t* expr, const function_t* fn) {
+    for (size_t i = 0; i < expr->deps.len; i++)
+        if (expr->deps.data[i].fn == fn)
+            return;
+    vec_push(&(expr->deps), ((expr_dep_t) { .fn = fn, .version = fn->version }));
+}
+
+// a call to a user-defined function that was already expanded
+struct expansion {
+    const function_t* fn;
+    ast_span_t site;
+
+    // position of the arguments in the expander's args
+    uint32_t args;
+    uint32_t root;
+};
+
+// state carried through the expansion of an expression
+// bodies calling the same function with the same arguments more than
+// once would otherwise be copied over and over, growing exponentially
+// with the depth of the calls. so inlined nodes identical to one already
+// emitted are shared, and calls expanded before aren't expanded again
+struct expander {
+    expr_t* expr;
+    ast_t* dst;
+
+    // open addressed table of inlined nodes in dst
+    uint32_t* nodes;
+    size_t nodes_size, num_nodes;
+
+    // open addressed table of calls in done
+    uint32_t* calls;
+    size_t calls_size;
+    vec_struct(struct expansion) done;
+    vec_struct(uint32_t) args;
+
+    // number of calls to impure functions emitted, which are never shared
+    size_t impure;
+    int errors;
+};
+
+static uint32_t hash_span(uint32_t h, ast_span_t span) {
+    h = (h ^ (uint32_t)span.pos) * 16777619u;
+    return (h ^ (uint32_t)span.len) * 16777619u;
+}
+
+// can the node be shared with identical ones, PARAMs never get emitted
+static bool is_shared(const ast_node_t* t) {
+    return t->type != NODE_TYPE_FUNCTION || (t->fn->flags & FN_PURE);
+}
+
+static uint32_t hash_node(const ast_node_t* t, const uint32_t* children, ast_span_t span) {
+    uint32_t h = (t->type * 31u + t->op) * 2654435761u;
+    switch (t->type) {
+        case NODE_TYPE_LITERAL: {
+            uint32_t bits;
+            memcpy(&bits, &(t->literal), sizeof(bits));
+            h ^= bits;
+        } break;
+        case NODE_TYPE_VARIABLE: h ^= t->input; break;
+        case NODE_TYPE_FUNCTION: h ^= (uint32_t)(uintptr_t)t->fn; break;
+        default: break;
+    }
+    for (uint32_t i = 0; i < t->num_children; i++)
+        h = (h ^ children[i]) * 16777619u;
+    return hash_span(h, span);
+}
+
+static bool same_node(const ast_t* ast, uint32_t i, const ast_node_t* t, const uint32_t* children, ast_span_t span) {
+    const ast_node_t* a = AST_NODE(ast, i);
+    if (a->type != t->type || a->op != t->op || a->num_children != t->num_children)
+        return false;
+    if (a->type == NODE_TYPE_LITERAL && memcmp(&(a->literal), &(t->literal), sizeof(a->literal)) != 0)
+        return false;
+    if ((a->type == NODE_TYPE_VARIABLE && a->input != t->input) || (a->type == NODE_TYPE_FUNCTION && a->fn != t->fn))
+        return false;
+    if (ast->spans.data[i].pos != span.pos || ast->spans.data[i].len != span.len)
+        return false;
+    for (uint32_t j = 0; j < t->num_children; j++)
+        if (AST_CHILD(ast, a, j) != children[j])
+            return false;
+    return true;
+}
+
+static uint32_t hash_call(const function_t* fn, const uint32_t* args, ast_span_t site) {
+    uint32_t h = (uint32_t)(uintptr_t)fn * 2654435761u;
+    for (int i = 0; i < fn->num_args; i++)
+        h = (h ^ args[i]) * 16777619u;
+    return hash_span(h, site);
+}
+
+// grow an open addressed table of n entries to fit one more,
+// rehashing its entries with hash(ctx, entry)
+static void table_reserve(uint32_t** table, size_t* size, size_t n, uint32_t (*hash)(void*, uint32_t), void* ctx) {
+    if (2 * (n + 1) <= *size)
+        return;
+
+    size_t new_size = *size ? 2 * *size : 64;
+    uint32_t* t = tmalloc(new_size * sizeof(uint32_t));
+    memset(t, 0xff, new_size * sizeof(uint32_t));
+    for (size_t i = 0; i < *size; i++) {
+        if ((*table)[i] == UINT32_MAX)
+            continue;
+        size_t h = hash(ctx, (*table)[i]) % new_size;
+        while (t[h] != UINT32_MAX)
+            h = (h + 1) % new_size;
+        t[h] = (*table)[i];
+    }
+    if (*table)
+        tfree(*table);
+    *table = t;
+    *size = new_size;
+}
+
+static uint32_t rehash_node(void* ctx, uint32_t i) {
+    const ast_t* ast = ctx;
+    const ast_node_t* t = AST_NODE(ast, i);
+    return hash_node(t, &(AST_CHILD(ast, t, 0)), ast->spans.data[i]);
+}
+
+static uint32_t rehash_call(void* ctx, uint32_t i) {
+    const struct expander* e = ctx;
+    const struct expansion* c = &(e->done.data[i]);
+    return hash_call(c->fn, &(e->args.data[c->args]), c->site);
+}
+
+// add an inlined node to dst, or find an identical one already there
+static uint32_t push_inlined(struct expander* e, const ast_node_t* t, const uint32_t* children, ast_span_t span) {
+    if (!is_shared(t)) {
+        e->impure++;
+        return ast_push(e->dst, *t, children, span);
+    }
+
+    table_reserve(&(e->nodes), &(e->nodes_size), e->num_nodes, &rehash_node, e->dst);
+    size_t h = hash_node(t, children, span) % e->nodes_size;
+    for (; e->nodes[h] != UINT32_MAX; h = (h + 1) % e->nodes_size)
+        if (same_node(e->dst, e->nodes[h], t, children, span))
+            return e->nodes[h];
+
+    e->nodes[h] = ast_push(e->dst, *t, children, span);
+    e->num_nodes++;
+    return e->nodes[h];
+}
+
+static uint32_t expand(struct expander* e, const ast_t* src, uint32_t from, uint32_t root,
+                       const uint32_t* args, const ast_span_t* site);
+
+// expand a call to a user-defined function with the given arguments
+// returns UINT32_MAX if the call doesn't match the function anymore
+static uint32_t expand_call(struct expander* e, const function_t* fn, uint32_t num_args,
+                            const uint32_t* args, ast_span_t site) {
+    // definitions called by a body may have been redefined since
+    if ((uint32_t)fn->num_args != num_args) {
+        error_at_span(LG_ERR_WRONG_NUM_ARGS, e->expr, site);
+        e->errors++;
+        return UINT32_MAX;
+    }
+
+    table_reserve(&(e->calls), &(e->calls_size), e->done.len, &rehash_call, e);
+    size_t h = hash_call(fn, args, site) % e->calls_size;
+    for (; e->calls[h] != UINT32_MAX; h = (h + 1) % e->calls_size) {
+        const struct expansion* c = &(e->done.data[e->calls[h]]);
+        if (c->fn == fn && c->site.pos == site.pos && c->site.len == site.len
+            && memcmp(&(e->args.data[c->args]), args, num_args * sizeof(uint32_t)) == 0)
+            return c->root;
+    }
+
+    size_t impure = e->impure;
+    uint32_t res = expand(e, fn->body, 0, AST_ROOT(fn->body), args, &site);
+    add_dep(e->expr, fn);
+
+    // calls with side effects have to happen every time
+    // the table may have grown while expanding the body
+    if (res != UINT32_MAX && e->impure == impure) {
+        table_reserve(&(e->calls), &(e->calls_size), e->done.len, &rehash_call, e);
+        for (h = hash_call(fn, args, site) % e->calls_size; e->calls[h] != UINT32_MAX;)
+            h = (h + 1) % e->calls_size;
+
+        struct expansion c = { .fn = fn, .site = site, .args = e->args.len, .root = res };
+        for (uint32_t i = 0; i < num_args; i++)
+            vec_push(&(e->args), args[i]);
+        e->calls[h] = e->done.len;
+        vec_push(&(e->done), c);
+    }
+    return res;
+}
+
+// copy the nodes from..root of src into dst, replacing calls to user-defined
+// functions with their bodies. parameters refer to the already copied
+// arguments, which become shared by all their uses. inlined nodes take the
+// call site's span if site isn't NULL. returns the index of the copied root,
+// or UINT32_MAX on error
+static uint32_t expand(struct expander* e, const ast_t* src, uint32_t from, uint32_t root,
+                       const uint32_t* args, const ast_span_t* site) {
+    uint32_t* map = tmalloc((root - from + 1) * sizeof(uint32_t));
+    uint32_t res = UINT32_MAX;
+    for (uint32_t i = from; i <= root; i++) {
+        const ast_node_t* t = AST_NODE(src, i);
+        uint32_t children[t->num_children + 1];
+        for (uint32_t j = 0; j < t->num_children; j++)
+            children[j] = map[AST_CHILD(src, t, j) - from];
+        const ast_span_t* span = site ? site : &(src->spans.data[i]);
+
+        if (t->type == NODE_TYPE_PARAM)
+            map[i - from] = args[t->param];
+        else if (t->type == NODE_TYPE_FUNCTION && t->fn->body)
+            map[i - from] = expand_call(e, t->fn, t->num_children, children, *span);
+        else if (site)
+            map[i - from] = push_inlined(e, t, children, *span);
+        else
+            map[i - from] = ast_push(e->dst, *t, children, *span);
+
+        if (map[i - from] == UINT32_MAX)
+            goto out;
+    }
+    res = map[root - from];
+
+out:
+    tfree(map);
+    return res;
+}
+
+// inline all calls to user-defined functions, using their current
+// definitions, so compiled programs never call them
+int rt_expand(expr_t* expr) {
+    ast_t* ast = &(expr->ast);
+    uint32_t root = AST_ROOT(ast);
+    if (ast_is_def(ast)) {
+        // function definitions aren't compiled
+        const ast_node_t* t = AST_NODE(ast, root);
+        if (AST_NODE(ast, AST_CHILD(ast, t, 0))->type == NODE_TYPE_FUNCTION)
+            return 0;
+        root = AST_CHILD(ast, t, 1);
+    }
+
+    // only the value of a variable definition is kept
+    ast_t expanded;
+    ast_init(&expanded);
+    struct expander e = {
+        .expr = expr,
+        .dst = &expanded,
+        .done = vec_new(struct expansion),
+        .args = vec_new(uint32_t)
+    };
+    uint32_t res = expand(&e, ast, ast_subtree_start(ast, root), root, NULL, NULL);
+
+    // the last node is taken as the result, which an inlined body that
+    // returns a parameter leaves elsewhere. pushing it again lets the
+    // optimizer merge it with the original
+    if (res != UINT32_MAX && res != AST_ROOT(&expanded)) {
+        ast_node_t t = *AST_NODE(&expanded, res);
+        uint32_t children[t.num_children + 1];
+        for (uint32_t j = 0; j < t.num_children; j++)
+            children[j] = AST_CHILD(&expanded, &t, j);
+        ast_push(&expanded, t, children, expanded.spans.data[res]);
+    }
+
+    if (e.nodes)
+        tfree(e.nodes);
+    if (e.calls)
+        tfree(e.calls);
+    vec_destruct(&(e.done));
+    vec_destruct(&(e.args));
+    if (e.errors > 0) {
+        ast_destroy(&expanded);
+        return -1;
+    }
+    ast_destroy(ast);
+    *ast = expanded;
+    return 0;
 }
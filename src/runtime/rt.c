@@ -1,34 +1,123 @@
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include "rt.h"
 #include "utils/hashmap.h"
+#include "parsing/ast.h"
+#include "utils/intern.h"
 
 // operator definitions
 // NULLed operators are implemented inline
 operator_t rt_ops[UINT8_MAX + 1] = {
-    ['='] = { .name = '=', .precedence = 100, .eval = NULL },
-    ['+'] = { .name = '+', .precedence = 200, .eval = NULL },
-    ['-'] = { .name = '-', .precedence = 200, .eval = NULL },
-    ['*'] = { .name = '*', .precedence = 400, .eval = NULL },
-    ['/'] = { .name = '/', .precedence = 400, .eval = NULL },
-    ['^'] = { .name = '^', .precedence = 600, .eval = &powf }
+    ['=']    = { .name = '=',    .str = "=",  .precedence = 100, .eval = NULL },
+    [OP_OR]  = { .name = OP_OR,  .str = "||", .precedence = 110, .eval = NULL },
+    [OP_AND] = { .name = OP_AND, .str = "&&", .precedence = 120, .eval = NULL },
+    [OP_EQ]  = { .name = OP_EQ,  .str = "==", .precedence = 130, .eval = NULL },
+    [OP_NE]  = { .name = OP_NE,  .str = "!=", .precedence = 130, .eval = NULL },
+    ['<']    = { .name = '<',    .str = "<",  .precedence = 140, .eval = NULL },
+    ['>']    = { .name = '>',    .str = ">",  .precedence = 140, .eval = NULL },
+    [OP_LE]  = { .name = OP_LE,  .str = "<=", .precedence = 140, .eval = NULL },
+    [OP_GE]  = { .name = OP_GE,  .str = ">=", .precedence = 140, .eval = NULL },
+    ['+']    = { .name = '+',    .str = "+",  .precedence = 200, .eval = NULL },
+    ['-']    = { .name = '-',    .str = "-",  .precedence = 200, .eval = NULL },
+    ['*']    = { .name = '*',    .str = "*",  .precedence = 400, .eval = NULL },
+    ['/']    = { .name = '/',    .str = "/",  .precedence = 400, .eval = NULL },
+    ['^']    = { .name = '^',    .str = "^",  .precedence = 600, .eval = &powf }
 };
 
+// built-in function implementations, each with a
+// scalar and a batch variant
+#define UNARY_FN(id, f)                                                        \
+    static float fn_##id(int, float a[]) { return f(a[0]); }                   \
+    static void fn_##id##_batch(int, const float* a[], float* out, size_t n) { \
+        for (size_t i = 0; i < n; i++)                                         \
+            out[i] = f(a[0][i]);                                               \
+    }
+
+#define FOLD_FN(id, f)                                                         \
+    static float fn_##id(int n, float a[]) {                                   \
+        float r = a[0];                                                        \
+        for (int i = 1; i < n; i++)                                            \
+            r = f(r, a[i]);                                                    \
+        return r;                                                              \
+    }                                                                          \
+    static void fn_##id##_batch(int n, const float* a[], float* out, size_t len) { \
+        for (size_t i = 0; i < len; i++)                                       \
+            out[i] = a[0][i];                                                  \
+        for (int j = 1; j < n; j++)                                            \
+            for (size_t i = 0; i < len; i++)                                   \
+                out[i] = f(out[i], a[j][i]);                                   \
+    }
+
+UNARY_FN(sin, sinf)
+UNARY_FN(cos, cosf)
+UNARY_FN(tan, tanf)
+UNARY_FN(abs, fabsf)
+UNARY_FN(floor, floorf)
+FOLD_FN(max, fmaxf)
+FOLD_FN(min, fminf)
+
+// if(cond, a, b), lowered to IR_SELECT
+static float fn_if(int, float a[]) {
+    return a[0] != 0 ? a[1] : a[2];
+}
+
+static void fn_if_batch(int, const float* a[], float* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[0][i] != 0 ? a[1][i] : a[2][i];
+}
+
+#define BUILTIN(id, n) \
+    { .name = #id, .num_args = n, .eval = &fn_##id, .eval_batch = &fn_##id##_batch, .flags = FN_PURE, .op = IR_CALL }
+
 // function definitions
 // a -1 means variable number of arguments
 static function_t rt_funcs[] = {
-    { .name = "sin", .num_args = 1, .eval = NULL },
-    { .name = "cos", .num_args = 1, .eval = NULL },
-    { .name = "tan", .num_args = 1, .eval = NULL },
-    { .name = "abs", .num_args = 1, .eval = NULL },
-    { .name = "floor", .num_args = 1, .eval = NULL },
-    { .name = "max", .num_args = -1, .eval = NULL },
-    { .name = "min", .num_args = -1, .eval = NULL },
+    BUILTIN(sin, 1),
+    BUILTIN(cos, 1),
+    BUILTIN(tan, 1),
+    BUILTIN(abs, 1),
+    BUILTIN(floor, 1),
+    BUILTIN(max, -1),
+    BUILTIN(min, -1),
+    { .name = "if", .num_args = 3, .eval = &fn_if, .eval_batch = &fn_if_batch, .flags = FN_PURE, .op = IR_SELECT }
 };
 #define RT_NUM_FUNCS (sizeof(rt_funcs) / sizeof(rt_funcs[0]))
 
+// names of the plot inputs, in order
+static const char* rt_inputs[RT_NUM_INPUTS] = { "x", "y" };
+
 static hashmap_t* fn_map;
 
+// functions indexed by the interned id of their name,
+// so the resolver can find them without comparing strings
+static vec_struct(function_t*) fn_ids;
+static int32_t input_ids[RT_NUM_INPUTS];
+
+// add a function to both lookup tables
+static void fn_add(function_t* fn) {
+    hm_add(fn_map, fn->name, (uint64_t)fn);
+
+    int32_t id = intern(fn->name, strlen(fn->name));
+    while (fn_ids.len <= (size_t)id)
+        vec_push(&fn_ids, NULL);
+    fn_ids.data[id] = fn;
+}
+
+// get function information from the id of its name
+function_t* rt_get_fn_id(int32_t id) {
+    return (size_t)id < fn_ids.len ? fn_ids.data[id] : NULL;
+}
+
+// get index of a plot input from the id of its name
+// returns -1 if it isn't one
+int rt_get_input_id(int32_t id) {
+    for (int i = 0; i < RT_NUM_INPUTS; i++)
+        if (input_ids[i] == id)
+            return i;
+    return -1;
+}
+
 // get function information from name
 function_t* rt_get_fn(const char* name)
 {
@@ -38,6 +127,77 @@ function_t* rt_get_fn(const char* name)
     return NULL;
 }
 
+// get index of a plot input from its name
+// returns -1 if it isn't one
+int rt_get_input(const char* name) {
+    for (int i = 0; i < RT_NUM_INPUTS; i++)
+        if (strcmp(name, rt_inputs[i]) == 0)
+            return i;
+    return -1;
+}
+
+// add or replace a user-defined function, taking ownership of its body
+// variables are stored as functions with no arguments,
+// returns -1 if the name belongs to a built-in function
+int rt_define(const char* name, int num_args, ast_t* body) {
+    function_t* fn = rt_get_fn(name);
+    if (fn && fn->body == NULL)
+        return -1;
+
+    if (fn) {
+        // redefinition, replace the old body
+        ast_destroy(fn->body);
+        tfree(fn->body);
+    } else {
+        fn = tmalloc(sizeof(function_t));
+        fn->name = tmalloc(strlen(name) + 1);
+        strcpy(fn->name, name);
+        fn->eval = NULL;
+        fn->eval_batch = NULL;
+        fn->flags = FN_PURE;
+        fn->op = IR_CALL;
+        fn->version = 0;
+        fn_add(fn);
+    }
+    fn->num_args = num_args;
+    fn->body = body;
+    fn->version++;
+    return 0;
+}
+
+// add a function implemented by the host, which takes at least one
+// argument, since calls need one. returns -1 if the name is taken or
+// not a valid identifier
+int rt_register_fn(const char* name, int num_args, float (*eval)(int, float[]),
+                   void (*eval_batch)(int, const float*[], float*, size_t), int flags) {
+    if (eval == NULL || num_args <= 0 || rt_get_fn(name) || rt_get_input(name) != -1)
+        return -1;
+
+    // same rules as the tokenizer
+    for (size_t i = 0; name[i] != '\0'; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (i > 0 && c >= '0' && c <= '9')))
+            return -1;
+    }
+    if (name[0] == '\0')
+        return -1;
+
+    function_t* fn = tmalloc(sizeof(function_t));
+    *fn = (function_t) {
+        .name = tmalloc(strlen(name) + 1),
+        .num_args = num_args,
+        .eval = eval,
+        .eval_batch = eval_batch,
+        .flags = flags,
+        .op = IR_CALL,
+        .body = NULL,
+        .version = 0
+    };
+    strcpy(fn->name, name);
+    fn_add(fn);
+    return 0;
+}
+
 // initialize runtime
 void rt_init() {
     // add all functions to hashmap
@@ -45,5 +205,7 @@ void rt_init() {
     // in a more powerful language
     fn_map = hm_create(HASHMAP_SIZE_DEFAULT);
     for (size_t i = 0; i < RT_NUM_FUNCS; i++)
-        hm_add(fn_map, rt_funcs[i].name, (uint64_t)(&(rt_funcs[i])));
+        fn_add(&(rt_funcs[i]));
+    for (int i = 0; i < RT_NUM_INPUTS; i++)
+        input_ids[i] = intern(rt_inputs[i], strlen(rt_inputs[i]));
 }
@@ -3,17 +3,58 @@
 #include <stdint.h>
 #include "utils/vector.h"
 #include "expression.h"
+#include "runtime/ir.h"
+
+// number of plot inputs (x and y)
+#define RT_NUM_INPUTS 2
+
+// operators spelled with two characters, coded
+// outside the range of printable characters
+enum {
+    OP_LE = 1,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_OR
+};
 
 typedef struct {
     uint8_t name;
+    const char* str;
     int precedence;
     float (*eval)(float, float);
 } operator_t;
 
-typedef struct {
+// function has no side effects and its result depends only on
+// its arguments, so calls to it can be folded and shared
+#define FN_PURE (1 << 0)
+
+// number of points evaluated together by batch evaluation
+#define RT_BLOCK_SIZE 256
+
+typedef struct function {
     char* name;
     int num_args;
     float (*eval)(int num_args, float args[]);
+
+    // optional, evaluates n points at once
+    // args[i][j] is argument i of point j
+    void (*eval_batch)(int num_args, const float* args[], float* out, size_t n);
+    int flags;
+
+    // instruction calls are lowered to, IR_CALL unless
+    // the function is built into the IR
+    ir_op_t op;
+
+    // body of a user-defined function, with its parameters
+    // as NODE_TYPE_PARAM nodes. NULL for built-in functions
+    // calls to other user-defined functions are kept as calls,
+    // and only expanded when compiling an expression
+    ast_t* body;
+
+    // incremented on every redefinition
+    uint32_t version;
 } function_t;
 
 typedef struct {
@@ -22,9 +63,41 @@ typedef struct {
     bool is_mut;
 } variable_t;
 
+// a subtree of a profiled program, rooted at an instruction
+typedef struct {
+    // span of the subtree in the source string
+    int pos, len;
+
+    // times the root was executed, cycles spent in it
+    // and in the whole subtree
+    uint64_t count, self_cycles, cycles;
+} prof_entry_t;
+
 extern operator_t rt_ops[];
 
 void rt_init();
 function_t* rt_get_fn(const char* name);
+function_t* rt_get_fn_id(int32_t id);
+int rt_get_input(const char* name);
+int rt_get_input_id(int32_t id);
+int rt_define(const char* name, int num_args, ast_t* body);
+int rt_register_fn(const char* name, int num_args, float (*eval)(int, float[]),
+                   void (*eval_batch)(int, const float*[], float*, size_t), int flags);
 variable_t rt_get_var(const char* name);
 int rt_resolve(expr_t* expr);
+int rt_expand(expr_t* expr);
+int rt_lower(expr_t* expr);
+int rt_optimize(expr_t* expr);
+ir_prog_t* rt_fuse(const ir_prog_t* const progs[], size_t n, uint32_t results[]);
+float rt_eval_inst(const ir_prog_t* prog, const ir_inst_t* inst, const float regs[]);
+float rt_eval(const ir_prog_t* prog, const float inputs[]);
+void rt_eval_batch(const ir_prog_t* prog, const float* inputs[], float* out, size_t n);
+void rt_eval_batch_multi(const ir_prog_t* prog, const uint32_t results[], size_t num_results,
+                         const float* inputs[], float* outs[], size_t n);
+void rt_set_profiling(bool enabled);
+bool rt_profiling_enabled(void);
+uint64_t rt_cycles(void);
+ir_counter_t* rt_profile_counters(const ir_prog_t* prog);
+void rt_profile_add(ir_counter_t* counter, uint64_t count, uint64_t cycles);
+void rt_profile_reset(const ir_prog_t* prog);
+size_t rt_profile_report(const ir_prog_t* prog, prof_entry_t* out, size_t max);
@@ -0,0 +1,117 @@
+/*
+    Library-wide string interning
+    strings are copied into large chunks, so interning a new name
+    doesn't allocate every time, and looking up a known name only
+    takes a shared lock
+*/
+
+#include <string.h>
+#include <pthread.h>
+#include "intern.h"
+#include "utils/tmalloc.h"
+
+#define CHUNK_SIZE (64 << 10)
+
+static struct {
+    pthread_rwlock_t lock;
+
+    // open addressed table of ids, -1 for empty slots
+    int32_t* table;
+    size_t table_size;
+
+    // strings by id
+    const char** strs;
+    size_t num_strs, alloc_strs;
+
+    // space left in the current chunk of string storage
+    char* chunk;
+    size_t chunk_left;
+} pool = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER
+};
+
+static uint32_t hash(const char* str, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t)str[i]) * 16777619u;
+    return h;
+}
+
+// find the slot holding a string, or the empty slot it would go in
+static size_t find_slot(const char* str, size_t len, uint32_t h) {
+    size_t i = h & (pool.table_size - 1);
+    for (; pool.table[i] != -1; i = (i + 1) & (pool.table_size - 1)) {
+        const char* s = pool.strs[pool.table[i]];
+        if (strncmp(s, str, len) == 0 && s[len] == '\0')
+            break;
+    }
+    return i;
+}
+
+static void grow_table(void) {
+    int32_t* old = pool.table;
+    size_t old_size = pool.table_size;
+
+    pool.table_size = old_size ? 2 * old_size : 1024;
+    pool.table = tmalloc(pool.table_size * sizeof(int32_t));
+    memset(pool.table, 0xff, pool.table_size * sizeof(int32_t));
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i] == -1)
+            continue;
+        const char* s = pool.strs[old[i]];
+        pool.table[find_slot(s, strlen(s), hash(s, strlen(s)))] = old[i];
+    }
+    if (old)
+        tfree(old);
+}
+
+// copy a string into chunked storage
+static const char* store(const char* str, size_t len) {
+    if (pool.chunk_left < len + 1) {
+        size_t size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+        pool.chunk = tmalloc(size);
+        pool.chunk_left = size;
+    }
+    char* s = pool.chunk;
+    memcpy(s, str, len);
+    s[len] = '\0';
+    pool.chunk += len + 1;
+    pool.chunk_left -= len + 1;
+    return s;
+}
+
+// get the id of a string of length len, adding it if it's new
+int32_t intern(const char* str, size_t len) {
+    uint32_t h = hash(str, len);
+
+    pthread_rwlock_rdlock(&pool.lock);
+    int32_t id = pool.table ? pool.table[find_slot(str, len, h)] : -1;
+    pthread_rwlock_unlock(&pool.lock);
+    if (id != -1)
+        return id;
+
+    // someone may have added it in the meantime
+    pthread_rwlock_wrlock(&pool.lock);
+    if (pool.num_strs >= pool.table_size / 2)
+        grow_table();
+    size_t slot = find_slot(str, len, h);
+    if (pool.table[slot] == -1) {
+        if (pool.num_strs == pool.alloc_strs) {
+            pool.alloc_strs = pool.alloc_strs ? 2 * pool.alloc_strs : 1024;
+            pool.strs = trealloc(pool.strs, pool.alloc_strs * sizeof(const char*));
+        }
+        pool.strs[pool.num_strs] = store(str, len);
+        pool.table[slot] = pool.num_strs++;
+    }
+    id = pool.table[slot];
+    pthread_rwlock_unlock(&pool.lock);
+    return id;
+}
+
+// get the string of an id
+const char* intern_str(int32_t id) {
+    pthread_rwlock_rdlock(&pool.lock);
+    const char* s = pool.strs[id];
+    pthread_rwlock_unlock(&pool.lock);
+    return s;
+}
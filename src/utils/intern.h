@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// maps every distinct string to a small integer id, shared by the
+// whole library. ids and strings stay valid forever
+int32_t intern(const char* str, size_t len);
+const char* intern_str(int32_t id);
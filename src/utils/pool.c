@@ -0,0 +1,285 @@
+/*
+    Work-stealing thread pool shared by the whole library
+    every worker owns a deque of tasks, taking new work from its
+    bottom and stealing from the top of other deques when empty.
+    threads outside the pool submit to a separate shared deque,
+    and help run tasks while waiting on a group, sleeping once
+    there are none left to take
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "pool.h"
+#include "utils/tmalloc.h"
+
+typedef struct {
+    task_fn_t fn;
+    void* arg;
+    task_group_t* group;
+} task_t;
+
+// ring buffer of tasks
+typedef struct {
+    pthread_mutex_t lock;
+    task_t* tasks;
+    size_t head, len, alloc_len;
+} deque_t;
+
+static struct {
+    int num_workers;
+    pthread_t* threads;
+
+    // one deque per worker, plus one for outside threads
+    deque_t* deques;
+
+    // number of tasks sitting in deques, idle workers sleep on wake
+    // and threads waiting on a group sleep on done
+    atomic_size_t queued;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake, done;
+    bool stop;
+} pool;
+
+// index of the deque owned by this thread
+static _Thread_local int worker_id = -1;
+
+static void deque_init(deque_t* d) {
+    pthread_mutex_init(&(d->lock), NULL);
+    d->alloc_len = 64;
+    d->tasks = tmalloc(d->alloc_len * sizeof(task_t));
+    d->head = 0;
+    d->len = 0;
+}
+
+static void deque_destroy(deque_t* d) {
+    pthread_mutex_destroy(&(d->lock));
+    tfree(d->tasks);
+}
+
+// add to the bottom
+static void deque_push(deque_t* d, task_t t) {
+    pthread_mutex_lock(&(d->lock));
+    if (d->len == d->alloc_len) {
+        // grow and unwrap the ring
+        task_t* tasks = tmalloc(2 * d->alloc_len * sizeof(task_t));
+        for (size_t i = 0; i < d->len; i++)
+            tasks[i] = d->tasks[(d->head + i) % d->alloc_len];
+        tfree(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->alloc_len *= 2;
+    }
+    d->tasks[(d->head + d->len) % d->alloc_len] = t;
+    d->len++;
+    pthread_mutex_unlock(&(d->lock));
+}
+
+// take from the bottom (owner) or the top (thieves)
+static bool deque_pop(deque_t* d, task_t* t, bool steal) {
+    pthread_mutex_lock(&(d->lock));
+    bool found = d->len > 0;
+    if (found) {
+        if (steal) {
+            *t = d->tasks[d->head];
+            d->head = (d->head + 1) % d->alloc_len;
+        } else
+            *t = d->tasks[(d->head + d->len - 1) % d->alloc_len];
+        d->len--;
+    }
+    pthread_mutex_unlock(&(d->lock));
+    return found;
+}
+
+// find a task, starting with our own deque
+static bool find_task(task_t* t) {
+    if (pool.deques == NULL || atomic_load(&pool.queued) == 0)
+        return false;
+
+    int n = pool.num_workers + 1;
+    int self = worker_id == -1 ? pool.num_workers : worker_id;
+    if (deque_pop(&(pool.deques[self]), t, self == pool.num_workers))
+        goto found;
+    for (int i = 1; i < n; i++)
+        if (deque_pop(&(pool.deques[(self + i) % n]), t, true))
+            goto found;
+    return false;
+
+found:
+    atomic_fetch_sub(&pool.queued, 1);
+    return true;
+}
+
+static void run_task(task_t* t) {
+    t->fn(t->arg);
+    if (atomic_fetch_sub(&(t->group->pending), 1) > 1 || pool.deques == NULL)
+        return;
+
+    // the group may be gone once pending is 0, only the pool is touched
+    pthread_mutex_lock(&pool.sleep_lock);
+    pthread_cond_broadcast(&pool.done);
+    pthread_mutex_unlock(&pool.sleep_lock);
+}
+
+static void* worker_main(void* arg) {
+    worker_id = (int)(size_t)arg;
+    for (;;) {
+        task_t t;
+        if (find_task(&t)) {
+            run_task(&t);
+            continue;
+        }
+
+        // nothing to do, sleep until more work arrives
+        pthread_mutex_lock(&pool.sleep_lock);
+        while (!pool.stop && atomic_load(&pool.queued) == 0)
+            pthread_cond_wait(&pool.wake, &pool.sleep_lock);
+        bool stop = pool.stop;
+        pthread_mutex_unlock(&pool.sleep_lock);
+        if (stop)
+            return NULL;
+    }
+}
+
+// start the pool with the given number of threads
+// 0 means one per processor
+int pool_init(int num_threads) {
+    if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0)
+        num_threads = 1;
+
+    // the waiting thread always helps, so it counts as one
+    pool.num_workers = num_threads - 1;
+    pool.stop = false;
+    atomic_store(&pool.queued, 0);
+    pthread_mutex_init(&pool.sleep_lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.done, NULL);
+
+    pool.deques = tmalloc((pool.num_workers + 1) * sizeof(deque_t));
+    for (int i = 0; i <= pool.num_workers; i++)
+        deque_init(&(pool.deques[i]));
+
+    pool.threads = tmalloc((pool.num_workers + 1) * sizeof(pthread_t));
+    for (int i = 0; i < pool.num_workers; i++) {
+        if (pthread_create(&(pool.threads[i]), NULL, &worker_main, (void*)(size_t)i) != 0) {
+            // run with the threads we managed to start
+            pool.num_workers = i;
+            break;
+        }
+    }
+    return 0;
+}
+
+// stop all workers, there must be no tasks in flight
+void pool_shutdown(void) {
+    if (pool.deques == NULL)
+        return;
+
+    pthread_mutex_lock(&pool.sleep_lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.sleep_lock);
+    for (int i = 0; i < pool.num_workers; i++)
+        pthread_join(pool.threads[i], NULL);
+
+    // deques past num_workers may exist if thread creation failed
+    for (int i = 0; i <= pool.num_workers; i++)
+        deque_destroy(&(pool.deques[i]));
+    tfree(pool.deques);
+    tfree(pool.threads);
+    pool.deques = NULL;
+    pthread_mutex_destroy(&pool.sleep_lock);
+    pthread_cond_destroy(&pool.wake);
+    pthread_cond_destroy(&pool.done);
+}
+
+// number of threads taking part in running tasks
+int pool_num_threads(void) {
+    return pool.num_workers + 1;
+}
+
+// queue a task as part of a group
+void pool_submit(task_group_t* group, task_fn_t fn, void* arg) {
+    atomic_fetch_add(&(group->pending), 1);
+    task_t t = { .fn = fn, .arg = arg, .group = group };
+
+    // no pool, run it right away
+    if (pool.deques == NULL) {
+        run_task(&t);
+        return;
+    }
+
+    int self = worker_id == -1 ? pool.num_workers : worker_id;
+    deque_push(&(pool.deques[self]), t);
+    atomic_fetch_add(&pool.queued, 1);
+
+    pthread_mutex_lock(&pool.sleep_lock);
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.sleep_lock);
+}
+
+// wait for all tasks of a group, running tasks in the meantime
+// once nothing is left to take, sleep until some group is done
+void pool_wait(task_group_t* group) {
+    while (atomic_load(&(group->pending)) > 0) {
+        task_t t;
+        if (find_task(&t)) {
+            run_task(&t);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.sleep_lock);
+        while (atomic_load(&(group->pending)) > 0 && atomic_load(&pool.queued) == 0)
+            pthread_cond_wait(&pool.done, &pool.sleep_lock);
+        pthread_mutex_unlock(&pool.sleep_lock);
+    }
+}
+
+struct for_chunk {
+    void (*fn)(void* ctx, size_t begin, size_t end);
+    void* ctx;
+    size_t begin, end;
+};
+
+static void for_task(void* arg) {
+    struct for_chunk* c = arg;
+    c->fn(c->ctx, c->begin, c->end);
+}
+
+// run fn over [0, n) in chunks of at least grain items
+// chunks are split finer than the number of threads, so uneven
+// chunks get balanced out by stealing
+void pool_for(size_t n, size_t grain, void (*fn)(void* ctx, size_t begin, size_t end), void* ctx) {
+    if (grain == 0)
+        grain = 1;
+
+    size_t num_chunks = (n + grain - 1) / grain;
+    size_t max_chunks = 8 * pool_num_threads();
+    if (num_chunks > max_chunks)
+        num_chunks = max_chunks;
+    if (num_chunks <= 1) {
+        if (n > 0)
+            fn(ctx, 0, n);
+        return;
+    }
+
+    // keep chunk boundaries on multiples of grain
+    size_t chunk = (n + num_chunks - 1) / num_chunks;
+    chunk = (chunk + grain - 1) / grain * grain;
+
+    task_group_t group = { 0 };
+    struct for_chunk chunks[num_chunks];
+    size_t c = 0;
+    for (size_t begin = 0; begin < n; begin += chunk, c++) {
+        chunks[c] = (struct for_chunk) {
+            .fn = fn,
+            .ctx = ctx,
+            .begin = begin,
+            .end = begin + chunk < n ? begin + chunk : n
+        };
+        pool_submit(&group, &for_task, &(chunks[c]));
+    }
+    pool_wait(&group);
+}
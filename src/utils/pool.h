@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// a set of tasks that can be waited on together
+typedef struct {
+    atomic_size_t pending;
+} task_group_t;
+
+typedef void (*task_fn_t)(void* arg);
+
+int pool_init(int num_threads);
+void pool_shutdown(void);
+int pool_num_threads(void);
+void pool_submit(task_group_t* group, task_fn_t fn, void* arg);
+void pool_wait(task_group_t* group);
+void pool_for(size_t n, size_t grain, void (*fn)(void* ctx, size_t begin, size_t end), void* ctx);
@@ -1,4 +1,3 @@
-#ifdef DEBUG
 #define _GNU_SOURCE // for asprintf
 #include <malloc.h>
 #include <stdint.h>
@@ -7,8 +6,57 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <pthread.h>
 #include "tmalloc.h"
 
+// bytes held by all allocations, as reported by the allocator, split
+// into counters on their own cache lines so threads allocating at the
+// same time don't contend. each thread sticks to one of them, and memory
+// freed on another thread than it was allocated on can make one negative
+#define USAGE_SHARDS 64
+static struct {
+    alignas(64) atomic_long bytes;
+} usage[USAGE_SHARDS];
+static atomic_uint next_shard;
+static _Thread_local int shard = -1;
+
+static void count(void* addr, int sign) {
+    if (shard == -1)
+        shard = atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) % USAGE_SHARDS;
+    long size = malloc_usable_size(addr);
+    atomic_fetch_add_explicit(&(usage[shard].bytes), sign * size, memory_order_relaxed);
+}
+
+// total bytes currently allocated through tmalloc
+size_t tmalloc_usage(void) {
+    long total = 0;
+    for (int i = 0; i < USAGE_SHARDS; i++)
+        total += atomic_load_explicit(&(usage[i].bytes), memory_order_relaxed);
+    return total < 0 ? 0 : total;
+}
+
+#ifndef DEBUG
+void* counted_malloc(size_t s) {
+    void* addr = malloc(s);
+    count(addr, 1);
+    return addr;
+}
+
+void* counted_realloc(void* addr, size_t s) {
+    count(addr, -1);
+    addr = realloc(addr, s);
+    count(addr, 1);
+    return addr;
+}
+
+void counted_free(void* addr) {
+    count(addr, -1);
+    free(addr);
+}
+#else
+
 typedef struct adata_t {
     uint64_t addr;
     size_t size;
@@ -21,6 +69,9 @@ typedef struct adata_t {
 
 static adata_t* ainfo;
 
+// the allocation list is shared by all threads
+static pthread_mutex_t ainfo_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void mem_err(char* s, const char* file, int line, const char* function) {
     printf("\033[0;31;1mmemory error:\033[0m %s\n", s);
     printf("in %s:%d (function %s)\n\n", file, line, function);
@@ -30,9 +81,11 @@ static void mem_err(char* s, const char* file, int line, const char* function) {
 void* trace_malloc(size_t s, const char* file, int line, const char* function)
 {
     void* addr =  malloc(s);
+    count(addr, 1);
 
     // append new record for address
     adata_t* ninfo = malloc(sizeof(adata_t));
+    pthread_mutex_lock(&ainfo_lock);
     *ninfo = (adata_t) {
         .addr = (uint64_t)addr,
         .size = s,
@@ -42,6 +95,7 @@ void* trace_malloc(size_t s, const char* file, int line, const char* function)
         .next = ainfo
     };
     ainfo = ninfo;
+    pthread_mutex_unlock(&ainfo_lock);
     return addr;
 }
 
@@ -50,6 +104,7 @@ void* trace_realloc(void* addr, size_t s, const char* file, int line, const char
         return trace_malloc(s, file, line, function);
 
     // find previous record of address
+    pthread_mutex_lock(&ainfo_lock);
     adata_t* oinfo = NULL;
     for (adata_t* i = ainfo; i != NULL; i = i->next)
         if (i->addr == (uint64_t)addr)
@@ -58,16 +113,21 @@ void* trace_realloc(void* addr, size_t s, const char* file, int line, const char
         mem_err("tried to reallocate an invalid address", file, line, function);
 
     // update previous record
+    count(addr, -1);
     oinfo->addr = (uint64_t)realloc(addr, s);
+    count((void*)(oinfo->addr), 1);
     oinfo->size = s;
     oinfo->file = file;
     oinfo->line = line;
     oinfo->function = function;
-    return (void*)(oinfo->addr);
+    void* naddr = (void*)(oinfo->addr);
+    pthread_mutex_unlock(&ainfo_lock);
+    return naddr;
 }
 
 void trace_free(void* addr, const char* file, int line, const char* function) {
     // find address record and remove it
+    pthread_mutex_lock(&ainfo_lock);
     adata_t* temp;
     if (ainfo->addr == (uint64_t)addr) {
         temp = ainfo;
@@ -85,13 +145,16 @@ void trace_free(void* addr, const char* file, int line, const char* function) {
         inf->next = inf->next->next;
         free(temp);
     }
+    pthread_mutex_unlock(&ainfo_lock);
 
+    count(addr, -1);
     return free(addr);
 }
 
 void tmalloc_log_show() {
     size_t memsize = 0;
 
+    pthread_mutex_lock(&ainfo_lock);
     char* prev = NULL;
     int repeat = 0;
     for (adata_t* i = ainfo; i != NULL; i = i->next) {
@@ -110,6 +173,7 @@ void tmalloc_log_show() {
         memsize += i->size;
     }
     if (prev) free(prev);
+    pthread_mutex_unlock(&ainfo_lock);
     printf("total %ld bytes of allocated memory\n", memsize);
 }
 #endif
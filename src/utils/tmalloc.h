@@ -8,16 +8,21 @@
     #define trealloc(ptr, s) trace_realloc(ptr, s, __FILE__, __LINE__, __FUNCTION__)
     #define tfree(s) trace_free(s, __FILE__, __LINE__, __FUNCTION__)
 #else
-    #define tmalloc(s) malloc(s)
-    #define trealloc(ptr, s) realloc(ptr, s)
-    #define tfree(s) free(s)
+    #define tmalloc(s) counted_malloc(s)
+    #define trealloc(ptr, s) counted_realloc(ptr, s)
+    #define tfree(s) counted_free(s)
 #endif
 
+size_t tmalloc_usage(void);
+
 #ifdef DEBUG
 void* trace_malloc(size_t s, const char* file, int line, const char* function);
 void trace_free(void* addr, const char* file, int line, const char* function);
 void* trace_realloc(void* addr, size_t s, const char* file, int line, const char* function);
 void tmalloc_log_show();
 #else
+void* counted_malloc(size_t s);
+void* counted_realloc(void* addr, size_t s);
+void counted_free(void* addr);
     #define tmalloc_log_show()
 #endif
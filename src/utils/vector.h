@@ -44,6 +44,6 @@
 #define vec_iterate(vec, var)                                                               \
         if ((vec)->len > 0)                                                                 \
             for (typeof(*((vec)->data)) (var) = (vec)->data[0]; (vec)->iter < (vec)->len;   \
-             (var) = (vec)->data[++((vec)->iter)])
+             (var) = (vec)->data[++((vec)->iter) < (vec)->len ? (vec)->iter : 0])
 
 #define vec_iterate_end(vec) (vec)->iter = 0
@@ -0,0 +1,68 @@
+/*
+    Background thread running queued tasks one after another,
+    for work that must not hold up the thread asking for it,
+    and that shouldn't compete with evaluation in the pool
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "worker.h"
+#include "utils/tmalloc.h"
+
+struct queued {
+    task_fn_t fn;
+    void* arg;
+    struct queued* next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool started;
+
+    // oldest first
+    struct queued *first, *last;
+} worker = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+static void* worker_main(void*) {
+    pthread_mutex_lock(&worker.lock);
+    for (;;) {
+        while (worker.first == NULL)
+            pthread_cond_wait(&worker.wake, &worker.lock);
+
+        struct queued* q = worker.first;
+        worker.first = q->next;
+        if (worker.first == NULL)
+            worker.last = NULL;
+
+        pthread_mutex_unlock(&worker.lock);
+        q->fn(q->arg);
+        tfree(q);
+        pthread_mutex_lock(&worker.lock);
+    }
+    return NULL;
+}
+
+// queue a task for the background thread, starting it if needed
+void worker_submit(task_fn_t fn, void* arg) {
+    struct queued* q = tmalloc(sizeof(struct queued));
+    *q = (struct queued) { .fn = fn, .arg = arg, .next = NULL };
+
+    pthread_mutex_lock(&worker.lock);
+    if (!worker.started) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, &worker_main, NULL);
+        pthread_detach(thread);
+        worker.started = true;
+    }
+    if (worker.last)
+        worker.last->next = q;
+    else
+        worker.first = q;
+    worker.last = q;
+    pthread_cond_signal(&worker.wake);
+    pthread_mutex_unlock(&worker.lock);
+}
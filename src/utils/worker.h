@@ -0,0 +1,5 @@
+#pragma once
+
+#include "pool.h"
+
+void worker_submit(task_fn_t fn, void* arg);
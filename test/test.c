@@ -1,9 +1,139 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <dlfcn.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+// types and constants from the library interface
+typedef struct {
+    int code;
+    int pos, len;
+    const char* msg;
+} lg_diag_t;
+
+typedef struct {
+    int pos, len;
+    uint64_t count, self_cycles, cycles;
+} lg_profile_entry_t;
+typedef struct {
+    int kind;
+    int id;
+    uint32_t color;
+    float width;
+} lg_layer_t;
+#define LG_LAYER_CURVE 0
+#define LG_LAYER_CONTOUR 1
+#define LG_LAYER_FILL 2
+#define LG_ERR_UNRESOLVED_NAME 10
+#define LG_ERR_NOT_A_DEFINITION 14
+#define LG_LOAD_FAILED -1
+#define LG_LOAD_READY 0
+#define LG_LOAD_PENDING 1
 
 // pointers to library function(s)
 static int (*lg_load)(char*);
 static void (*lg_init)(void);
+static void (*lg_set_threads)(int);
+static float (*lg_eval)(int, float, float);
+static void (*lg_eval_batch)(int, const float*, const float*, float*, size_t);
+static void (*lg_eval_grid)(int, float, float, float, float, int, int, float*, size_t);
+static void (*lg_eval_view)(int, int, int64_t, int64_t, int, int, float*, size_t);
+static size_t (*lg_load_many)(const char**, size_t, int*, const lg_diag_t**, size_t*);
+static size_t (*lg_diagnostics)(const lg_diag_t**);
+static size_t (*lg_find_roots)(int, float, float, float, float*, size_t);
+static size_t (*lg_find_intersections)(int, int, float, float, float*, size_t);
+static float (*lg_integrate)(int, float, float, float, float);
+static void (*lg_free)(int);
+static size_t (*lg_memory_usage)(int);
+static size_t (*lg_memory_total)(void);
+static void (*lg_sample_curve)(int, float, float, size_t, float*, float*);
+static size_t (*lg_simplify_polyline)(float*, float*, size_t, float, float, float);
+static void (*lg_set_profiling)(int);
+static size_t (*lg_profile)(int, lg_profile_entry_t*, size_t);
+static void (*lg_set_error_output)(int);
+static int (*lg_approximate)(int, float, float, float);
+static int (*lg_load_file)(const char*);
+static int (*lg_edit)(int, const char*, int, int, int);
+static void (*lg_render)(const lg_layer_t*, size_t, float, float, float, float, int, int, uint32_t, uint8_t*, size_t);
+static void (*lg_eval_batch_many)(const int*, size_t, const float*, const float*, float**, size_t);
+static int (*lg_load_async)(const char*, void (*)(int, int, void*), void*);
+static int (*lg_load_status)(int);
+static size_t (*lg_load_diagnostics)(int, const lg_diag_t**);
+static int (*lg_register_fn)(const char*, int, float (*)(int, float[]),
+                             void (*)(int, const float*[], float*, size_t), int);
+
+// check a view of an expression against evaluating its pixel centers
+static int check_view(int id, int zoom, int64_t px, int64_t py, int w, int h) {
+    static float view[200 * 200];
+    lg_eval_view(id, zoom, px, py, w, h, view, w);
+    float size = 1.0f / (1 << zoom);
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++) {
+            float x = (px + i + 0.5f) * size, y = -(py + j + 0.5f) * size;
+            if (!(fabsf(view[j*w + i] - lg_eval(id, x, y)) <= 1e-4f)) {
+                printf("=== view evaluation failed at pixel (%d, %d) ===\n", i, j);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// squared distance in pixels from a point to a segment
+static float seg_dist2(float px, float py, float ax, float ay, float bx, float by) {
+    float dx = bx - ax, dy = by - ay, len2 = dx*dx + dy*dy;
+    float t = len2 > 0 ? ((px - ax)*dx + (py - ay)*dy) / len2 : 0;
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    float ex = ax + t*dx - px, ey = ay + t*dy - py;
+    return ex*ex + ey*ey;
+}
+
+// check a simplified curve against its samples, which must be
+// close to the segment between the vertices kept around them
+static int check_simplified(const float* xs, const float* ys, size_t n,
+                            const float* sx, const float* sy, size_t m, float px, float tol) {
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        while (j + 2 < m && sx[j + 1] < xs[i])
+            j++;
+        if (seg_dist2(xs[i] / px, ys[i] / px, sx[j] / px, sy[j] / px, sx[j + 1] / px, sy[j + 1] / px)
+            > tol * tol * 1.01f) {
+            printf("=== simplification failed at sample %lu ===\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// functions registered by the host
+static float sumsq(int, float a[]) {
+    return a[0]*a[0] + a[1]*a[1];
+}
+
+static void sumsq_batch(int, const float* a[], float* out, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = a[0][i]*a[0][i] + a[1][i]*a[1][i];
+}
+
+static float counter(int, float a[]) {
+    static float count = 0;
+    return a[0] + count++;
+}
+
+static void loaded(int, int, void* calls) {
+    atomic_fetch_add((atomic_int*)calls, 1);
+}
+
+// holds up the background thread until the gate is opened
+static atomic_int gate;
+static void wait_gate(int, int, void* calls) {
+    while (atomic_load(&gate) == 0)
+        sched_yield();
+    atomic_fetch_add((atomic_int*)calls, 1);
+}
 
 // test expressions
 static char *tests[] = {
@@ -11,10 +141,38 @@ static char *tests[] = {
         "sin(x) + cos(y) - 1",
         "max(x^2, 2*x, abs(x*y))",
         "r = x^2 + sin(2*x^2)",
-        "the_answer_to_life_the_universe_and_everything = 42"
+        "the_answer_to_life_the_universe_and_everything = 42",
+        "f(t) = t^2 + 1",
+        "g(a, b) = f(a) - f(b)",
+        "g(x, y) + f(r)",
+        "step(t) = if(t > 0 && t <= 1, t, 0)",
+        "twice(t) = f(t) + f(t + 1)",
+        "quad(t) = twice(t) + twice(t + 1)",
+        "sel(a, b) = a"
 };
 #define TESTS_LEN (sizeof(tests) / sizeof(tests[0]))
 
+// expressions checked against their value at a point
+static struct {
+    char* str;
+    float x, y, val;
+} evals[] = {
+        { "2*x + y", 1, 2, 4 },
+        { "max(x, y, 3) - min(x, y)", 5, -1, 6 },
+        { "f(3)", 0, 0, 10 },
+        { "g(x, y)", 2, 1, 3 },
+        { "g(y, the_answer_to_life_the_universe_and_everything)", 0, 1, -1763 },
+        { "sumsq(3, 4) + sumsq(x, y)", 1, 2, 30 },
+        { "counter(0) - counter(0)", 0, 0, -1 },
+        { "if(x < 0, 0 - x, x^2) + (y >= 1) + (x == y || x != x)", -3, 1, 4 },
+        { "step(x) + step(y) + 2*step(y - 1)", 0.5f, 2, 2.5f },
+        { "if(2 > 1, x, y) - if(0, x, y)", 5, 3, 2 },
+        { "quad(x) + quad(y)", 0, 1, 32 },
+        { "sel(x, 5)", 2, 0, 2 },
+        { "sel(sin(x), cos(x))", 0, 0, 0 }
+};
+#define EVALS_LEN (sizeof(evals) / sizeof(evals[0]))
+
 int main(void) {
     printf("test: opening libgrapher.so\n");
     void* lib = dlopen("libgrapher.so", RTLD_LAZY);
@@ -26,13 +184,47 @@ int main(void) {
     // get the function(s)
     lg_load = (typeof(lg_load))dlsym(lib, "lg_load");
     lg_init = (typeof(lg_init))dlsym(lib, "lg_init");
-    if (!lg_load || !lg_init) {
+    lg_eval = (typeof(lg_eval))dlsym(lib, "lg_eval");
+    lg_eval_batch = (typeof(lg_eval_batch))dlsym(lib, "lg_eval_batch");
+    lg_register_fn = (typeof(lg_register_fn))dlsym(lib, "lg_register_fn");
+    lg_set_threads = (typeof(lg_set_threads))dlsym(lib, "lg_set_threads");
+    lg_eval_grid = (typeof(lg_eval_grid))dlsym(lib, "lg_eval_grid");
+    lg_eval_view = (typeof(lg_eval_view))dlsym(lib, "lg_eval_view");
+    lg_diagnostics = (typeof(lg_diagnostics))dlsym(lib, "lg_diagnostics");
+    lg_set_error_output = (typeof(lg_set_error_output))dlsym(lib, "lg_set_error_output");
+    lg_load_many = (typeof(lg_load_many))dlsym(lib, "lg_load_many");
+    lg_find_roots = (typeof(lg_find_roots))dlsym(lib, "lg_find_roots");
+    lg_find_intersections = (typeof(lg_find_intersections))dlsym(lib, "lg_find_intersections");
+    lg_integrate = (typeof(lg_integrate))dlsym(lib, "lg_integrate");
+    lg_free = (typeof(lg_free))dlsym(lib, "lg_free");
+    lg_memory_usage = (typeof(lg_memory_usage))dlsym(lib, "lg_memory_usage");
+    lg_memory_total = (typeof(lg_memory_total))dlsym(lib, "lg_memory_total");
+    lg_sample_curve = (typeof(lg_sample_curve))dlsym(lib, "lg_sample_curve");
+    lg_simplify_polyline = (typeof(lg_simplify_polyline))dlsym(lib, "lg_simplify_polyline");
+    lg_set_profiling = (typeof(lg_set_profiling))dlsym(lib, "lg_set_profiling");
+    lg_profile = (typeof(lg_profile))dlsym(lib, "lg_profile");
+    lg_edit = (typeof(lg_edit))dlsym(lib, "lg_edit");
+    lg_render = (typeof(lg_render))dlsym(lib, "lg_render");
+    lg_eval_batch_many = (typeof(lg_eval_batch_many))dlsym(lib, "lg_eval_batch_many");
+    lg_load_file = (typeof(lg_load_file))dlsym(lib, "lg_load_file");
+    lg_approximate = (typeof(lg_approximate))dlsym(lib, "lg_approximate");
+    lg_load_async = (typeof(lg_load_async))dlsym(lib, "lg_load_async");
+    lg_load_status = (typeof(lg_load_status))dlsym(lib, "lg_load_status");
+    lg_load_diagnostics = (typeof(lg_load_diagnostics))dlsym(lib, "lg_load_diagnostics");
+    if (!lg_load || !lg_init || !lg_eval || !lg_eval_batch || !lg_register_fn || !lg_set_threads || !lg_eval_grid
+        || !lg_eval_view || !lg_diagnostics || !lg_set_error_output || !lg_load_many || !lg_find_roots
+        || !lg_find_intersections || !lg_integrate || !lg_free || !lg_memory_usage || !lg_memory_total
+        || !lg_sample_curve || !lg_simplify_polyline || !lg_set_profiling || !lg_profile
+        || !lg_load_async || !lg_load_status || !lg_load_diagnostics || !lg_approximate
+        || !lg_load_file || !lg_eval_batch_many || !lg_edit || !lg_render) {
         fprintf(stderr, "error: dlsym(): %s\n", dlerror());
         return -1;
     }
 
     // initialize library
     lg_init();
+    lg_register_fn("sumsq", 2, &sumsq, &sumsq_batch, 1);
+    lg_register_fn("counter", 1, &counter, NULL, 0);
 
     // run tests
     size_t fails = 0;
@@ -44,6 +236,334 @@ int main(void) {
         }
     }
 
-    printf("\n%lu/%lu tests passed\n", TESTS_LEN - fails, TESTS_LEN);
+    for (size_t i = 0; i < EVALS_LEN; i++) {
+        printf("\n=== eval %lu: \"%s\" ===\n", i+1, evals[i].str);
+        int id = lg_load(evals[i].str);
+        float val = lg_eval(id, evals[i].x, evals[i].y);
+        if (id == -1 || !(fabsf(val - evals[i].val) <= 1e-3f)) {
+            printf("=== eval %lu failed: got %f, expected %f ===\n", i+1, val, evals[i].val);
+            fails++;
+        }
+    }
+
+    // functions without arguments could never be called, so
+    // they aren't registered
+    printf("\n=== registration ===\n");
+    if (lg_register_fn("seven", 0, &sumsq, NULL, 1) != -1 || lg_load("seven()") != -1) {
+        printf("=== registration failed ===\n");
+        fails++;
+    }
+
+    // batch evaluation must agree with evaluating point by point
+    printf("\n=== batch evaluation ===\n");
+    lg_set_threads(4);
+    int id = lg_load("sin(x) + cos(y) - sumsq(x, y) + 2*sin(x)");
+    static float xs[100000], ys[100000], out[100000];
+    for (int i = 0; i < 100000; i++) {
+        xs[i] = i * 0.0001f;
+        ys[i] = 1 - i * 0.0002f;
+    }
+    lg_eval_batch(id, xs, ys, out, 100000);
+    for (int i = 0; i < 100000; i++) {
+        if (!(fabsf(out[i] - lg_eval(id, xs[i], ys[i])) <= 1e-4f)) {
+            printf("=== batch evaluation failed at point %d ===\n", i);
+            fails++;
+            break;
+        }
+    }
+
+    // grid cells must match their centers, including partial tiles
+    printf("\n=== grid evaluation ===\n");
+    id = lg_load("sin(x) + cos(y) - 1");
+    int w = 150, h = 70;
+    lg_eval_grid(id, -2, -1, 4, 1, w, h, out, w + 3);
+    for (int j = 0; j < h; j++) {
+        for (int i = 0; i < w; i++) {
+            float x = -2 + (i + 0.5f) * 6 / w, y = 1 - (j + 0.5f) * 2 / h;
+            if (!(fabsf(out[j*(w + 3) + i] - lg_eval(id, x, y)) <= 1e-4f)) {
+                printf("=== grid evaluation failed at cell (%d, %d) ===\n", i, j);
+                fails++;
+                goto grid_done;
+            }
+        }
+    }
+grid_done:
+
+    // panning reuses tiles, redefining a variable invalidates them
+    printf("\n=== view evaluation ===\n");
+    lg_load("k = 2");
+    id = lg_load("k*x + y");
+    fails += check_view(id, 4, -50, -30, 150, 80);
+    fails += check_view(id, 4, -33, -21, 150, 80);
+    lg_load("k = 3");
+    fails += check_view(id, 4, -33, -21, 150, 80);
+    // a stale definition evaluates with the new k without redefining kr
+    int kr_def = lg_load("kr = k + 1");
+    lg_load("kr = 7");
+    lg_load("k = 4");
+    if (lg_eval(id, 1, 0) != 4 || lg_eval(kr_def, 0, 0) != 5 || lg_eval(lg_load("kr*1"), 0, 0) != 7) {
+        printf("=== redefinition was not picked up ===\n");
+        fails++;
+    }
+
+    // errors are recorded without being printed
+    printf("\n=== diagnostics ===\n");
+    lg_set_error_output(0);
+    const lg_diag_t* diags;
+    if (lg_load("sin(q) + 2*nope") != -1 || lg_diagnostics(&diags) != 2
+        || diags[0].code != LG_ERR_UNRESOLVED_NAME || diags[0].pos != 4 || diags[0].len != 1
+        || diags[1].pos != 11 || diags[1].len != 4) {
+        printf("=== diagnostics failed ===\n");
+        fails++;
+    }
+
+    // compiling many expressions at once, definitions coming first
+    printf("\n=== bulk loading ===\n");
+    static char srcs[200][32];
+    const char* src_ptrs[201];
+    int ids[201];
+    const lg_diag_t* batch_diags[201];
+    size_t num_diags[201];
+    for (int i = 0; i < 200; i++) {
+        sprintf(srcs[i], "bulk_c*x + %d", i);
+        src_ptrs[i] = srcs[i];
+    }
+    src_ptrs[200] = "bulk_c = 2 + sin(";
+    if (lg_load_many(src_ptrs, 200, ids, batch_diags, num_diags) != 0 || num_diags[0] != 1) {
+        printf("=== bulk loading with missing definition failed ===\n");
+        fails++;
+    }
+    src_ptrs[200] = "bulk_c = 5";
+    if (lg_load_many(src_ptrs, 201, ids, batch_diags, num_diags) != 201 || num_diags[0] != 0
+        || lg_eval(ids[199], 2, 0) != 209) {
+        printf("=== bulk loading failed ===\n");
+        fails++;
+    }
+    lg_set_error_output(1);
+
+    // zeros of sin(x) are multiples of pi, sign changes across poles aren't zeros
+    printf("\n=== roots ===\n");
+    float roots[8];
+    int sine = lg_load("sin(x)"), parabola = lg_load("x^2"), line = lg_load("x + 2");
+    size_t num_roots = lg_find_roots(sine, -10, 10, 0, roots, 8);
+    for (size_t i = 0; i < num_roots && num_roots == 7; i++)
+        if (!(fabsf(roots[i] - ((int)i - 3) * 3.14159265f) <= 1e-4f))
+            num_roots = 0;
+    if (num_roots != 7 || lg_find_roots(lg_load("1/x"), -1, 1, 0, roots, 8) != 0
+        || lg_find_intersections(parabola, line, -5, 5, roots, 8) != 2
+        || !(fabsf(roots[0] + 1) <= 1e-4f) || !(fabsf(roots[1] - 2) <= 1e-4f)) {
+        printf("=== roots failed ===\n");
+        fails++;
+    }
+
+    // smooth integrands, and one that needs refining near a kink
+    printf("\n=== integration ===\n");
+    if (!(fabsf(lg_integrate(parabola, 0, 3, 0, 1e-5f) - 9) <= 1e-4f)
+        || !(fabsf(lg_integrate(sine, 0, 3.14159265f, 0, 1e-5f) - 2) <= 1e-4f)
+        || !(fabsf(lg_integrate(lg_load("abs(x - 0.3)^0.5"), 0, 1, 0, 1e-5f) - 0.49999f) <= 1e-4f)) {
+        printf("=== integration failed ===\n");
+        fails++;
+    }
+
+    // simplified curves stay close to their samples with far fewer vertices
+    printf("\n=== curve simplification ===\n");
+    static float cx[20000], cy[20000];
+    lg_sample_curve(sine, -10, 10, 20000, xs, ys);
+    for (int i = 0; i < 20000; i++) {
+        cx[i] = xs[i];
+        cy[i] = ys[i];
+    }
+    size_t kept = lg_simplify_polyline(cx, cy, 20000, 0.01f, 0.01f, 0.5f);
+    if (kept > 1000 || cx[0] != -10 || cx[kept - 1] != 10
+        || check_simplified(xs, ys, 20000, cx, cy, kept, 0.01f, 0.5f)) {
+        printf("=== curve simplification failed with %lu vertices ===\n", kept);
+        fails++;
+    }
+
+    // narrow spikes are kept, even where the curve comes back down
+    // along nearly the same direction it went up
+    float spx[] = { 0, 0.1f, 0.2f }, spy[] = { 0, 10, 5 };
+    kept = lg_simplify_polyline(spx, spy, 3, 1, 1, 0.5f);
+    lg_sample_curve(lg_load("100/(1 + (x*20)^2)"), -5, 5, 20000, xs, ys);
+    for (int i = 0; i < 20000; i++) {
+        cx[i] = xs[i];
+        cy[i] = ys[i];
+    }
+    size_t peak_kept = lg_simplify_polyline(cx, cy, 20000, 0.01f, 0.01f, 0.5f);
+    if (kept != 3 || check_simplified(xs, ys, 20000, cx, cy, peak_kept, 0.01f, 0.5f)) {
+        printf("=== spike simplification failed ===\n");
+        fails++;
+    }
+
+    // the whole expression is the hottest subtree, and calls
+    // are reported along with their parentheses
+    printf("\n=== profiling ===\n");
+    lg_set_profiling(1);
+    id = lg_load("2*y + max(x, sin(x^2))");
+    lg_eval_batch(id, xs, ys, out, 1000);
+    lg_set_profiling(0);
+    lg_eval_batch(id, xs, ys, out, 1000);
+    lg_profile_entry_t prof[16];
+    size_t num_prof = lg_profile(id, prof, 16);
+    int found_call = 0;
+    for (size_t i = 0; i < num_prof; i++)
+        found_call |= prof[i].pos == 13 && prof[i].len == 8 && prof[i].count == 1000;
+    if (num_prof < 5 || prof[0].pos != 0 || prof[0].len != 22 || prof[0].count != 1000 || !found_call) {
+        printf("=== profiling failed ===\n");
+        fails++;
+    }
+
+    // freeing gives memory back, and the handle gets reused
+    printf("\n=== freeing ===\n");
+    size_t before = lg_memory_total();
+    id = lg_load("sin(x)*cos(y) + x^3 - 2*y");
+    check_view(id, 3, 0, 0, 100, 100);
+    size_t usage = lg_memory_usage(id);
+    lg_free(id);
+    if (usage == 0 || lg_memory_usage(id) != 0 || lg_memory_total() != before
+        || lg_load("x + 1") != id || lg_eval(id, 1, 0) != 2) {
+        printf("=== freeing failed ===\n");
+        fails++;
+    }
+
+    // background compiles finish in order, and failures release their handle
+    printf("\n=== async loading ===\n");
+    static atomic_int loaded_calls;
+    lg_set_error_output(0);
+    int async_ids[3] = {
+        lg_load_async("async_k = 7", &loaded, &loaded_calls),
+        lg_load_async("async_k*x", &loaded, &loaded_calls),
+        lg_load_async("nope_async + 1", &loaded, &loaded_calls)
+    };
+    while (atomic_load(&loaded_calls) < 3 || lg_load_status(async_ids[2]) == LG_LOAD_PENDING)
+        sched_yield();
+    lg_set_error_output(1);
+    int ready = (lg_load_status(async_ids[0]) == LG_LOAD_READY) + (lg_load_status(async_ids[1]) == LG_LOAD_READY);
+    int async_ok = ready == 2 && lg_load_status(async_ids[2]) == LG_LOAD_FAILED && lg_eval(async_ids[1], 2, 0) == 14;
+    const lg_diag_t* async_diags;
+    async_ok &= lg_load_diagnostics(async_ids[2], &async_diags) == 1 && async_diags[0].code == LG_ERR_UNRESOLVED_NAME
+        && async_diags[0].pos == 0 && lg_load_diagnostics(async_ids[1], &async_diags) == 0;
+
+    // handles aren't given out again before they are freed, nor
+    // while their compile is still running
+    async_ok &= lg_eval(async_ids[2], 0, 0) != lg_eval(async_ids[2], 0, 0);
+    id = lg_load("1");
+    async_ok &= id != async_ids[2] && lg_load_status(async_ids[2]) == LG_LOAD_FAILED;
+    lg_free(async_ids[2]);
+    lg_free(id);
+    lg_load_async("1", &wait_gate, &loaded_calls);
+    int queued = lg_load_async("2", &loaded, &loaded_calls);
+    lg_free(queued);
+    id = lg_load("3");
+    async_ok &= id != queued && lg_load_status(queued) == LG_LOAD_FAILED;
+    atomic_store(&gate, 1);
+    while (atomic_load(&loaded_calls) < 5)
+        sched_yield();
+    if (!async_ok) {
+        printf("=== async loading failed ===\n");
+        fails++;
+    }
+
+    // approximations stay within their tolerance, and only
+    // stand in for expressions in x alone
+    printf("\n=== chebyshev approximation ===\n");
+    int exact = lg_load("sin(2*x^2)");
+    id = lg_load("sin(2*x^2)");
+    int pieces = lg_approximate(id, -2, 2, 1e-4);
+    lg_sample_curve(exact, -2.5, 2.5, 1000, xs, ys);
+    lg_sample_curve(id, -2.5, 2.5, 1000, xs, out);
+    float max_err = 0;
+    for (int i = 0; i < 1000; i++) {
+        float err = out[i] > ys[i] ? out[i] - ys[i] : ys[i] - out[i];
+        max_err = err > max_err ? err : max_err;
+    }
+    if (pieces < 1 || max_err > 2e-4 || lg_eval(id, 2.25, 0) != lg_eval(exact, 2.25, 0)
+        || lg_approximate(lg_load("x*y"), -1, 1, 1e-4) != -1) {
+        printf("=== chebyshev approximation failed ===\n");
+        fails++;
+    }
+
+    // files are loaded line by line, with problems placed in the file
+    printf("\n=== loading files ===\n");
+    static const char lib_src[] = "file_k = 2\r\nf_file(t) = t*t + file_k\n\n \t \nbad_file(\n"
+                                  "file_k + 1\ng_file(t) = f_file(t) + 1\n\0\n";
+    FILE* lib_file = fopen("/tmp/lg_test_lib.txt", "w");
+    fwrite(lib_src, 1, sizeof(lib_src) - 1, lib_file);
+    fclose(lib_file);
+    lg_set_error_output(0);
+    int num_loaded = lg_load_file("/tmp/lg_test_lib.txt");
+    lg_set_error_output(1);
+    const lg_diag_t* file_diags;
+    size_t num_file_diags = lg_diagnostics(&file_diags);
+    int bad_pos = strstr(lib_src, "bad_file(") - lib_src + 9;
+    int expr_pos = strstr(lib_src, "file_k + 1") - lib_src;
+    remove("/tmp/lg_test_lib.txt");
+    if (num_loaded != 3 || num_file_diags != 3 || file_diags[0].pos != bad_pos
+        || file_diags[1].code != LG_ERR_NOT_A_DEFINITION || file_diags[1].pos != expr_pos
+        || file_diags[2].pos != (int)sizeof(lib_src) - 3
+        || lg_eval(lg_load("g_file(x)"), 3, 0) != 12 || lg_load_file("/tmp/lg_no_such_file") != -1) {
+        printf("=== loading files failed ===\n");
+        fails++;
+    }
+
+    // fused evaluation gives what evaluating one by one does
+    printf("\n=== fused evaluation ===\n");
+    int many_ids[4] = {
+        lg_load("sin(x)*y + 1"),
+        lg_load("sin(x)*y - x^2"),
+        lg_load("max(sin(x)*y, counter(0))"),
+        -1
+    };
+    static float many_out[4][1000];
+    float* many_outs[4] = { many_out[0], many_out[1], many_out[2], many_out[3] };
+    lg_eval_batch_many(many_ids, 4, xs, ys, many_outs, 1000);
+    int fused_ok = many_out[3][0] != many_out[3][0];
+    for (int k = 0; k < 2; k++) {
+        lg_eval_batch(many_ids[k], xs, ys, out, 1000);
+        for (int i = 0; i < 1000; i++)
+            fused_ok &= out[i] == many_out[k][i];
+    }
+    for (int i = 0; i < 1000; i++)
+        fused_ok &= many_out[2][i] >= many_out[0][i] - 1;
+    if (!fused_ok) {
+        printf("=== fused evaluation failed ===\n");
+        fails++;
+    }
+
+    // edits that don't compile keep the last good program, and
+    // edits that don't change the program keep its tiles
+    printf("\n=== editing ===\n");
+    id = lg_load("x*y + 1");
+    int edits_ok = lg_edit(id, "x*y + 12", 7, 0, 1) == 0 && lg_eval(id, 2, 3) == 18;
+    lg_set_error_output(0);
+    edits_ok &= lg_edit(id, "x*y + 12 *", 8, 0, 2) == -1 && lg_eval(id, 2, 3) == 18;
+    lg_set_error_output(1);
+    edits_ok &= lg_edit(id, "x*y + 12 * 2", 10, 0, 2) == 0 && lg_eval(id, 2, 3) == 30;
+    edits_ok &= check_view(id, 3, 0, 0, 100, 100) == 0;
+    size_t tiled = lg_memory_usage(id);
+    edits_ok &= lg_edit(id, "x*y + 12 *  2", 10, 0, 1) == 0 && lg_memory_usage(id) > tiled / 2;
+    if (!edits_ok) {
+        printf("=== editing failed ===\n");
+        fails++;
+    }
+
+    printf("\n=== rendering ===\n");
+    lg_layer_t layers[] = {
+        { LG_LAYER_FILL, lg_load("1 - x^2 - y^2"), 0xff0000ff, 0 },
+        { LG_LAYER_CURVE, lg_load("0*x + 1.25"), 0x0000ffff, 2 },
+        { LG_LAYER_CONTOUR, lg_load("x"), 0x00ff00ff, 1 }
+    };
+    static uint8_t image[60][80][4];
+    lg_render(layers, 3, -2, -1.5, 2, 1.5, 80, 60, 0xffffffff, &(image[0][0][0]), sizeof(image[0]));
+    #define PIXEL_IS(px, py, r, g, b) (abs(image[py][px][0] - r) <= 1 && abs(image[py][px][1] - g) <= 1 \
+                                       && abs(image[py][px][2] - b) <= 1 && image[py][px][3] == 255)
+    if (!PIXEL_IS(0, 0, 255, 255, 255) || !PIXEL_IS(30, 30, 255, 0, 0) || !PIXEL_IS(10, 4, 0, 0, 255)
+        || !PIXEL_IS(39, 15, 128, 128, 0)) {
+        printf("=== rendering failed ===\n");
+        fails++;
+    }
+    #undef PIXEL_IS
+
+    printf("\n%lu/%lu tests passed\n", TESTS_LEN + EVALS_LEN + 19 - fails, TESTS_LEN + EVALS_LEN + 19);
     return 0;
 }